@@ -0,0 +1,134 @@
+#ifndef DEF_CONCURRENTSIMPLEXMETHOD_HPP
+#define DEF_CONCURRENTSIMPLEXMETHOD_HPP
+
+#include "__include.hpp"
+#include "SimplexMethod.hpp"
+
+
+// runs one solver per pricing rule on the same problem at the same time
+// the first solver that finishes (with an optimum, or by proving the problem
+// infeasible or unbounded) wins, the others are cancelled between two pivots
+// all solvers share the extended matrix on disk, each reads it through its own stream
+template<typename V, typename S = V>
+class ConcurrentSimplexMethod {
+public:
+	using SolverType = SimplexMethod<V, S>;
+	using value_type = typename SolverType::value_type;
+	using DenseMatrixType = typename SolverType::DenseMatrixType;
+	using SolutionType = typename SolverType::SolutionType;
+
+	ConcurrentSimplexMethod(const string &filename, const DenseMatrixType &_vec_b, const DenseMatrixType &_vec_c,
+		const vector<PricingRule> &_rules = { PricingRule::dantzig,PricingRule::bland,PricingRule::normalized }) {
+		expr_check(!_rules.empty(), "no pricing rule given.");
+		rules = _rules;
+
+		solvers.emplace_back(new SolverType{ filename,_vec_b,_vec_c });
+		init_solvers();
+	}
+
+	ConcurrentSimplexMethod(const string &filename, const DenseMatrixType &_vec_b, const DenseMatrixType &_vec_c,
+		const vector<string> &shard_files,
+		const vector<PricingRule> &_rules = { PricingRule::dantzig,PricingRule::bland,PricingRule::normalized }) {
+		expr_check(!_rules.empty(), "no pricing rule given.");
+		rules = _rules;
+
+		solvers.emplace_back(new SolverType{ filename,_vec_b,_vec_c,shard_files });
+		init_solvers();
+	}
+
+	ConcurrentSimplexMethod(const ConcurrentSimplexMethod& other) = delete;
+	ConcurrentSimplexMethod(ConcurrentSimplexMethod&& other) = delete;
+
+	// returns the solution of the first solver that finishes, set val to be the maximum value
+	// if the winner proved that there is no solution, its exception is rethrown
+	SolutionType solve(value_type &val) {
+		CancellationToken token;
+		for (auto iter = solvers.begin(); iter != solvers.end(); ++iter) {
+			(*iter)->set_cancellation_token(token);
+		}
+
+		winner = -1;
+		SolutionType solution;
+		value_type winner_val = 0;
+		exception_ptr winner_error;
+		exception_ptr failure;
+		mutex result_mutex;
+
+		vector<thread> threads;
+		for (auto i = 0; i < (int)solvers.size(); ++i) {
+			threads.emplace_back([&, i]() {
+				try {
+					value_type cur_val;
+					auto cur_solution = solvers[i]->solve(cur_val);
+
+					lock_guard<mutex> lock{ result_mutex };
+					if (winner < 0) {
+						winner = i;
+						solution = move(cur_solution);
+						winner_val = cur_val;
+						token.cancel();
+					}
+				}
+				catch (const SolveCancelledError&) {
+				}
+				catch (const NoSolutionError&) {
+					finish_with_error(i, token, result_mutex, winner_error);
+				}
+				catch (const InfiniteSolutionsError&) {
+					finish_with_error(i, token, result_mutex, winner_error);
+				}
+				catch (...) {
+					// any other error only stops this solver, the others may still finish
+					lock_guard<mutex> lock{ result_mutex };
+					if (!failure)failure = current_exception();
+				}
+			});
+		}
+		for (auto iter = threads.begin(); iter != threads.end(); ++iter) {
+			iter->join();
+		}
+
+		if (winner < 0) {
+			rethrow_exception(failure);
+		}
+		if (winner_error)rethrow_exception(winner_error);
+		val = winner_val;
+		return solution;
+	}
+
+	// index (in the list of pricing rules) of the solver that finished first, -1 before solve()
+	// or if every solver failed
+	int get_winner() const { return winner; }
+	PricingRule get_winner_rule() const {
+		expr_check(winner >= 0, "no solver has finished.");
+		return rules[winner];
+	}
+
+	int solver_count() const { return (int)solvers.size(); }
+	SolverType &get_solver(int index) { return *solvers[index]; }
+
+protected:
+	vector<PricingRule> rules;
+	vector<unique_ptr<SolverType>> solvers;
+	int winner = -1;
+
+	void init_solvers() {
+		solvers.front()->set_pricing_rule(rules.front());
+		solvers.front()->set_verbose(false);
+		for (auto iter = rules.begin() + 1; iter != rules.end(); ++iter) {
+			solvers.emplace_back(new SolverType{ *solvers.front(),*iter });
+		}
+	}
+
+	void finish_with_error(int i, CancellationToken &token, mutex &result_mutex, exception_ptr &winner_error) {
+		lock_guard<mutex> lock{ result_mutex };
+		if (winner < 0) {
+			winner = i;
+			winner_error = current_exception();
+			token.cancel();
+		}
+	}
+};
+
+
+#endif // !DEF_CONCURRENTSIMPLEXMETHOD_HPP
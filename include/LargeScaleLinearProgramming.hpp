@@ -2,5 +2,6 @@
 #define DEF_LARGESCALESIMPLEXMETHOD_HPP
 
 #include "SimplexMethod.hpp"
+#include "ConcurrentSimplexMethod.hpp"
 
 #endif // !DEF_LARGESCALESIMPLEXMETHOD_HPP
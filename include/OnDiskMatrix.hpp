@@ -7,14 +7,85 @@
 
 constexpr int type_hint_length = 3;
 
-struct OnDiskMatrixHeader {
+// current on-disk format version
+constexpr uint32_t ondisk_format_version = 2;
+
+// the data section and every block starts at a multiple of this
+constexpr uint64_t ondisk_page_size = 4096;
+
+// default amount of payload covered by one block of the index
+constexpr uint64_t ondisk_default_block_bytes = 1 << 20;
+
+constexpr char ondisk_magic[4] = { 'O','D','M','X' };
+
+// header flags
+constexpr uint8_t ondisk_flag_block_index = 0x1;
+constexpr uint8_t ondisk_flag_checksums = 0x2;
+
+// version 1 header, only used to open old files (read-only)
+struct OnDiskMatrixHeaderV1 {
 	int32_t rows;
 	int32_t cols;
 	int32_t type_size;
 	char type_hint[type_hint_length];
 };
 
+constexpr int OnDiskMatrixHeaderV1_size = sizeof(OnDiskMatrixHeaderV1);
+
+// version 2 header
+// the layout is: header | block index | padding | block 0 | padding | block 1 | ...
+// each block holds block_rows consecutive rows and starts on a page boundary
+struct OnDiskMatrixHeader {
+	char magic[4];
+	uint32_t version;
+	int64_t rows;
+	int64_t cols;
+	int32_t type_size;
+	char type_hint[type_hint_length];
+	uint8_t flags;
+	uint64_t data_offset;
+	uint64_t index_offset;
+	int64_t block_rows;
+	int64_t block_count;
+};
+
 constexpr int OnDiskMatrixHeader_size = sizeof(OnDiskMatrixHeader);
+static_assert(OnDiskMatrixHeader_size == 64, "unexpected padding in OnDiskMatrixHeader");
+
+// one entry of the block index
+struct OnDiskMatrixBlockEntry {
+	uint64_t offset;
+	uint32_t checksum;
+	uint32_t reserved;
+};
+
+constexpr int OnDiskMatrixBlockEntry_size = sizeof(OnDiskMatrixBlockEntry);
+
+
+inline uint64_t ondisk_align_up(uint64_t val, uint64_t alignment) {
+	return (val + alignment - 1) / alignment * alignment;
+}
+
+// CRC-32 (IEEE 802.3), used for the block checksums
+inline uint32_t ondisk_crc32(const char *data, uint64_t length, uint32_t crc = 0) {
+	static const auto table = []() {
+		array<uint32_t, 256> ret{};
+		for (uint32_t i = 0; i < 256; ++i) {
+			uint32_t c = i;
+			for (auto k = 0; k < 8; ++k) {
+				c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			}
+			ret[i] = c;
+		}
+		return ret;
+	}();
+
+	crc = ~crc;
+	for (uint64_t i = 0; i < length; ++i) {
+		crc = table[(crc ^ static_cast<uint8_t>(data[i])) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
 
 
 template<typename V>
@@ -24,82 +95,164 @@ public:
 	using MatrixType = Eigen::Matrix<value_type, -1, -1,Eigen::RowMajor>;
 
 	// opens a matrix from file
+	// version 1 files, and files that cannot be opened for writing, are opened read-only
 	OnDiskMatrixBase(const string &filename) {
-		file.open(filename, ios::binary | ios::in | ios::out);
+		file.open(filename, ios::binary | ios::in);
+		expr_check(file.is_open(), "cannot open the matrix file.");
 
 		// read the header
+		char magic[4] = { '\0','\0','\0','\0' };
 		file.seekg(ios::beg);
-		file.read(reinterpret_cast<char*>(&header), OnDiskMatrixHeader_size);
+		file.read(magic, sizeof(magic));
+
+		if (equal(magic, magic + 4, ondisk_magic)) {
+			file.seekg(ios::beg);
+			file.read(reinterpret_cast<char*>(&header), OnDiskMatrixHeader_size);
+			expr_check(header.version == ondisk_format_version, "unsupported matrix file version.");
+
+			// reopen for writing, fall back to read-only (e.g. a read-only mount)
+			file.close();
+			file.open(filename, ios::binary | ios::in | ios::out);
+			if (!file.is_open()) {
+				file.clear();
+				file.open(filename, ios::binary | ios::in);
+				expr_check(file.is_open(), "cannot open the matrix file.");
+				read_only = true;
+			}
+
+			read_block_index();
+		}
+		else {
+			open_v1();
+		}
 
 		// check validity
 		verify_type();
 	}
 
 	// create a new empty matrix
-	OnDiskMatrixBase(const string &filename, int rows, int cols) {
+	OnDiskMatrixBase(const string &filename, int64_t rows, int64_t cols,
+		uint64_t block_bytes = ondisk_default_block_bytes) {
+		expr_check(rows >= 0 && cols >= 0, "invalid matrix size.");
+
 		// initialize header
+		copy(ondisk_magic, ondisk_magic + 4, header.magic);
+		header.version = ondisk_format_version;
 		header.rows = rows;
 		header.cols = cols;
 		header.type_size = type_size;
 		for (auto i = 0; i < type_hint_length; ++i) {
 			header.type_hint[i] = type_hint[i];
 		}
+		header.flags = ondisk_flag_block_index | ondisk_flag_checksums;
+
+		auto row_bytes = max<uint64_t>(1, get_row_bytes());
+		header.block_rows = max<int64_t>(1, static_cast<int64_t>(block_bytes / row_bytes));
+		header.block_count = (rows + header.block_rows - 1) / header.block_rows;
+		header.index_offset = OnDiskMatrixHeader_size;
+		header.data_offset = ondisk_align_up(header.index_offset +
+			header.block_count * OnDiskMatrixBlockEntry_size, ondisk_page_size);
+
+		// every block starts on a page boundary
+		auto block_stride = ondisk_align_up(header.block_rows * get_row_bytes(), ondisk_page_size);
+		blocks.resize(header.block_count);
+		for (int64_t i = 0; i < header.block_count; ++i) {
+			blocks[i] = OnDiskMatrixBlockEntry{ header.data_offset + i * block_stride, 0, 0 };
+		}
+		block_verified.assign(header.block_count, true);
+		block_dirty.assign(header.block_count, false);
 
 		// open file
 		file.open(filename, ios::binary|ios::in|ios::out|ios::trunc);
-		//file.seekp(ios::beg);
+		expr_check(file.is_open(), "cannot create the matrix file.");
 
 		// write header
 		file.write(reinterpret_cast<const char*>(&header), OnDiskMatrixHeader_size);
 
 		// fill the matrix with initialization value
 		fill(value_type{});
+		flush();
 	}
 
 	virtual ~OnDiskMatrixBase() {
-		//file.close();
+		if (!read_only && file.is_open()) {
+			commit_checksums();
+		}
 	};
 
 
-	// force writing data into file
+	// force writing data into file, updating the checksums of modified blocks
 	void flush() {
+		if (!read_only) {
+			commit_checksums();
+		}
 		file << std::flush;
 	}
 
-	MatrixType read_row(int row_ptr) {
+	MatrixType read_row(int64_t row_ptr) {
 		MatrixType ret{ 1,header.cols };
-		file.seekg(get_element_location(row_ptr, 0));
-		file.read(reinterpret_cast<char*>(ret.data()), header.cols * type_size);
+		read_row(row_ptr, ret);
 		return ret;
 	}
 
+	// read a row into a caller-provided buffer, which is only resized if its size is wrong
+	void read_row(int64_t row_ptr, MatrixType &ret) {
+		ret.resize(1, header.cols);
+		verify_block(get_block(row_ptr));
+		file.seekg(get_element_location(row_ptr, 0));
+		file.read(reinterpret_cast<char*>(ret.data()), get_row_bytes());
+	}
+
+	// read the elements [col_begin, col_begin + ret.cols()) of a row
+	// the checksum covers a whole block, so verifying reads the whole block once;
+	// pass verify = false when the block is verified elsewhere (see verify_blocks())
+	void read_row_range(int64_t row_ptr, int64_t col_begin, MatrixType &ret, bool verify = true) {
+		assert(ret.rows() == 1 && col_begin >= 0 && col_begin + ret.cols() <= header.cols);
+		if (verify)verify_block(get_block(row_ptr));
+		file.seekg(get_element_location(row_ptr, col_begin));
+		file.read(reinterpret_cast<char*>(ret.data()), ret.cols() * type_size);
+	}
+
+	// verify every step-th block starting from first, so that several readers of
+	// the same file can share the verification
+	void verify_blocks(int64_t first, int64_t step) {
+		for (auto i = first; i < header.block_count; i += step) {
+			verify_block(i);
+		}
+	}
+
 	// fill the entire matrix with a value
 	void fill(const value_type &val) {
 		MatrixType row{1,header.cols};
 		row.fill(val);
-		for (auto i = 0; i < header.rows; ++i) {
+		for (int64_t i = 0; i < header.rows; ++i) {
 			write_row(row, i);
 		}
 	}
 
-	void write_row(const MatrixType& matrix, int row_ptr) {
+	void write_row(const MatrixType& matrix, int64_t row_ptr) {
 		assert(matrix.cols() == header.cols);
+		check_writable();
 
+		mark_dirty(get_block(row_ptr));
 		file.seekp(get_element_location(row_ptr, 0));
-		file.write(reinterpret_cast<const char*>(matrix.data()), header.cols * type_size);
-		flush();
+		file.write(reinterpret_cast<const char*>(matrix.data()), get_row_bytes());
+		file << std::flush;
 	}
 
 	// avoid using
-	value_type get_element(int row_ptr, int col_ptr) {
+	value_type get_element(int64_t row_ptr, int64_t col_ptr) {
 		value_type ret;
+		verify_block(get_block(row_ptr));
 		file.seekg(get_element_location(row_ptr, col_ptr));
 		file.read(reinterpret_cast<char*>(&ret), type_size);
 		return ret;
 	}
 
 	// avoid using
-	value_type set_element(const value_type &val, int row_ptr, int col_ptr) {
+	void set_element(const value_type &val, int64_t row_ptr, int64_t col_ptr) {
+		check_writable();
+		mark_dirty(get_block(row_ptr));
 		file.seekp(get_element_location(row_ptr, col_ptr));
 		file.write(reinterpret_cast<const char*>(&val), type_size);
 	}
@@ -108,7 +261,7 @@ public:
 	void generate_transpose_matrix(const string& filename) {
 		// generate a new matrix
 		OnDiskMatrixBase<value_type> new_matrix{ filename,header.cols,header.rows };
-		for (auto i = 0; i < header.rows; ++i) {
+		for (int64_t i = 0; i < header.rows; ++i) {
 			auto row = move(read_row(i));
 			row.transposeInPlace();
 			new_matrix.write_col(row, i);
@@ -117,30 +270,161 @@ public:
 
 	const OnDiskMatrixHeader &get_header() const { return header; }
 
-	int rows() const { return header.rows; }
-	int cols() const { return header.cols; }
+	int64_t rows() const { return header.rows; }
+	int64_t cols() const { return header.cols; }
+
+	bool is_read_only() const { return read_only; }
 
 protected:
+	using TypeInfo<V>::type_size;
+	using TypeInfo<V>::type_hint;
+
 	OnDiskMatrixHeader header;
 	fstream file;
+	bool read_only = false;
+
+	// block index, loaded entirely into memory when the file is opened
+	vector<OnDiskMatrixBlockEntry> blocks;
+	// blocks are verified against their checksums when they are first read
+	vector<bool> block_verified;
+	// blocks written since the last flush, their checksums are stale
+	vector<bool> block_dirty;
+	// the checksum flag is cleared in the header on disk while blocks are dirty
+	bool checksums_pending = false;
+	// reused when computing checksums
+	vector<char> block_buffer;
+
+	uint64_t get_row_bytes() const {
+		return static_cast<uint64_t>(header.cols) * type_size;
+	}
+
+	int64_t get_block(int64_t row_ptr) const {
+		return row_ptr / header.block_rows;
+	}
+
+	int64_t get_block_row_count(int64_t block) const {
+		return min(header.block_rows, header.rows - block * header.block_rows);
+	}
 
-	streampos get_element_location(int row_ptr, int col_ptr) {
+	streampos get_element_location(int64_t row_ptr, int64_t col_ptr) {
 		assert(row_ptr > -1 && row_ptr < header.rows);
 		assert(col_ptr > -1 && col_ptr < header.cols);
 
-		return (streampos)OnDiskMatrixHeader_size +
-			((streampos)row_ptr * (streampos)header.cols +
+		const auto &block = blocks[get_block(row_ptr)];
+		return (streampos)block.offset +
+			((streampos)(row_ptr % header.block_rows) * (streampos)header.cols +
 			(streampos)col_ptr) * type_size;
 	}
 
-	void write_col(const MatrixType& matrix, int col_ptr) {
+	void write_col(const MatrixType& matrix, int64_t col_ptr) {
 		assert(matrix.rows() == header.rows);
+		check_writable();
 
-		for (auto i = 0; i < header.rows; ++i) {
+		for (int64_t i = 0; i < header.block_count; ++i) {
+			mark_dirty(i);
+		}
+		for (int64_t i = 0; i < header.rows; ++i) {
 			file.seekp(get_element_location(i, col_ptr));
 			file.write(reinterpret_cast<const char*>(&(matrix(i,0))), type_size);
 		}
-		flush();
+		file << std::flush;
+	}
+
+	void check_writable() {
+		expr_check(!read_only, "the matrix file is read-only.");
+	}
+
+	uint32_t compute_block_checksum(int64_t block) {
+		auto length = get_block_row_count(block) * get_row_bytes();
+		if (block_buffer.size() < length)block_buffer.resize(length);
+		file.seekg(blocks[block].offset);
+		file.read(block_buffer.data(), length);
+		return ondisk_crc32(block_buffer.data(), length);
+	}
+
+	// lazily check a block the first time it is read
+	void verify_block(int64_t block) {
+		if (block_verified[block] || block_dirty[block])return;
+		if (header.flags & ondisk_flag_checksums) {
+			expr_check(compute_block_checksum(block) == blocks[block].checksum, "block checksum does not match.");
+		}
+		block_verified[block] = true;
+	}
+
+	// recompute the checksums of modified blocks and rewrite the index
+	void commit_checksums() {
+		bool changed = false;
+		file << std::flush;
+		for (int64_t i = 0; i < header.block_count; ++i) {
+			if (!block_dirty[i])continue;
+			blocks[i].checksum = compute_block_checksum(i);
+			block_dirty[i] = false;
+			block_verified[i] = true;
+			changed = true;
+		}
+
+		if (changed) {
+			file.seekp(header.index_offset);
+			file.write(reinterpret_cast<const char*>(blocks.data()), blocks.size() * OnDiskMatrixBlockEntry_size);
+		}
+		if (checksums_pending) {
+			file << std::flush;
+			write_flags(header.flags);
+			checksums_pending = false;
+		}
+	}
+
+	// the first write after a commit clears the checksum flag in the header on
+	// disk, so that other objects opening the file meanwhile skip verification
+	// instead of reading new data against stale checksums
+	void mark_dirty(int64_t block) {
+		if (!checksums_pending && (header.flags & ondisk_flag_checksums)) {
+			write_flags(header.flags & ~ondisk_flag_checksums);
+			checksums_pending = true;
+		}
+		block_dirty[block] = true;
+	}
+
+	void write_flags(uint8_t flags) {
+		file.seekp(offsetof(OnDiskMatrixHeader, flags));
+		file.write(reinterpret_cast<const char*>(&flags), sizeof(flags));
+		file << std::flush;
+	}
+
+	void read_block_index() {
+		expr_check(header.block_rows > 0, "invalid block size in the matrix file.");
+		blocks.resize(header.block_count);
+		file.seekg(header.index_offset);
+		file.read(reinterpret_cast<char*>(blocks.data()), blocks.size() * OnDiskMatrixBlockEntry_size);
+		block_verified.assign(header.block_count, false);
+		block_dirty.assign(header.block_count, false);
+	}
+
+	// convert a version 1 header, the whole payload is treated as a single block
+	void open_v1() {
+		OnDiskMatrixHeaderV1 old_header;
+		file.seekg(ios::beg);
+		file.read(reinterpret_cast<char*>(&old_header), OnDiskMatrixHeaderV1_size);
+		expr_check(file.good(), "cannot read the matrix header.");
+
+		read_only = true;
+		copy(ondisk_magic, ondisk_magic + 4, header.magic);
+		header.version = 1;
+		header.rows = old_header.rows;
+		header.cols = old_header.cols;
+		header.type_size = old_header.type_size;
+		for (auto i = 0; i < type_hint_length; ++i) {
+			header.type_hint[i] = old_header.type_hint[i];
+		}
+		header.flags = 0;
+		header.data_offset = OnDiskMatrixHeaderV1_size;
+		header.index_offset = 0;
+		header.block_rows = max<int64_t>(1, header.rows);
+		header.block_count = 1;
+
+		blocks.assign(1, OnDiskMatrixBlockEntry{ header.data_offset, 0, 0 });
+		block_verified.assign(1, true);
+		block_dirty.assign(1, false);
 	}
 
 	virtual void verify_type() {
@@ -160,7 +444,7 @@ public:
 	using base_type = OnDiskMatrixBase<V>;
 
 	OnDiskMatrix(const string &filename) :base_type{ filename } {};
-	OnDiskMatrix(const string &filename, int rows, int cols) :base_type{ filename,rows,cols } {}
+	OnDiskMatrix(const string &filename, int64_t rows, int64_t cols) :base_type{ filename,rows,cols } {}
 	OnDiskMatrix(const OnDiskMatrix& other) = delete;
 	OnDiskMatrix(OnDiskMatrix&& other) = delete;
 	virtual ~OnDiskMatrix(){}
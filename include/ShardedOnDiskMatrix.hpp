@@ -0,0 +1,254 @@
+#ifndef DEF_SHARDEDONDISKMATRIX_HPP
+#define DEF_SHARDEDONDISKMATRIX_HPP
+
+#include "__include.hpp"
+#include "OnDiskMatrix.hpp"
+
+
+// first line of a manifest file
+constexpr char sharded_manifest_magic[] = "sharded_matrix";
+constexpr int sharded_manifest_version = 1;
+
+
+// a matrix whose rows are split into contiguous ranges, each stored in its own
+// OnDiskMatrix file (the files can be on different devices)
+// the manifest is a text file:
+//   sharded_matrix <version>
+//   <rows> <cols> <shard count>
+//   <first row> <end row> <file>     (one line per shard)
+// a relative file path is relative to the directory of the manifest, so the
+// manifest and its shards can be moved together
+// every shard has an I/O worker thread, for_each_shard() runs a task on all of
+// them at once so that the shards are read in parallel
+template<typename V>
+class ShardedOnDiskMatrix {
+public:
+	using value_type = V;
+	using ShardType = OnDiskMatrix<value_type>;
+	using MatrixType = typename ShardType::MatrixType;
+	using TaskType = function<void(int)>;
+
+	// opens a matrix from its manifest
+	explicit ShardedOnDiskMatrix(const string &manifest) {
+		ifstream file{ manifest };
+		expr_check(file.is_open(), "cannot open the manifest file.");
+
+		string magic;
+		int version;
+		int shard_count;
+		file >> magic >> version >> matrix_rows >> matrix_cols >> shard_count;
+		expr_check(file.good() && magic == sharded_manifest_magic, "invalid manifest file.");
+		expr_check(version == sharded_manifest_version, "unsupported manifest version.");
+		expr_check(shard_count > 0, "invalid number of shards.");
+
+		auto directory = filesystem::path{ manifest }.parent_path();
+		for (auto i = 0; i < shard_count; ++i) {
+			int64_t begin, end;
+			string filename;
+			file >> begin >> end;
+			getline(file >> ws, filename);
+			expr_check(!file.fail(), "invalid manifest file.");
+			expr_check(begin == (i == 0 ? 0 : shard_end[i - 1]) && end >= begin, "invalid shard range.");
+
+			// an absolute path is kept as it is
+			auto path = directory / filesystem::path{ filename };
+			shards.emplace_back(unique_ptr<ShardType>{ new ShardType{ path.string() } });
+			expr_check(shards.back()->rows() == end - begin && shards.back()->cols() == matrix_cols,
+				"the size of the shard does not match the manifest.");
+			shard_begin.push_back(begin);
+			shard_end.push_back(end);
+		}
+		expr_check(shard_end.back() == matrix_rows, "the shards do not cover the matrix.");
+
+		start_workers();
+	}
+
+	// create a new empty matrix, the rows are split evenly among the shard files
+	ShardedOnDiskMatrix(const string &manifest, int64_t rows, int64_t cols, const vector<string> &shard_files) {
+		expr_check(!shard_files.empty(), "no shard file given.");
+		matrix_rows = rows;
+		matrix_cols = cols;
+
+		auto shard_count = (int64_t)shard_files.size();
+		for (int64_t i = 0; i < shard_count; ++i) {
+			auto begin = rows * i / shard_count;
+			auto end = rows * (i + 1) / shard_count;
+			shards.emplace_back(unique_ptr<ShardType>{ new ShardType{ shard_files[i],end - begin,cols } });
+			shard_begin.push_back(begin);
+			shard_end.push_back(end);
+		}
+
+		ofstream file{ manifest, ios::trunc };
+		expr_check(file.is_open(), "cannot create the manifest file.");
+		file << sharded_manifest_magic << " " << sharded_manifest_version << "\n";
+		file << rows << " " << cols << " " << shard_count << "\n";
+		// the shard files are given relative to the working directory
+		auto directory = filesystem::absolute(manifest).parent_path();
+		for (int64_t i = 0; i < shard_count; ++i) {
+			filesystem::path path{ shard_files[i] };
+			if (path.is_relative())path = filesystem::proximate(path, directory);
+			file << shard_begin[i] << " " << shard_end[i] << " " << path.string() << "\n";
+		}
+		file.flush();
+		expr_check(file.good(), "cannot write the manifest file.");
+
+		start_workers();
+	}
+
+	ShardedOnDiskMatrix(const ShardedOnDiskMatrix& other) = delete;
+	ShardedOnDiskMatrix(ShardedOnDiskMatrix&& other) = delete;
+
+	virtual ~ShardedOnDiskMatrix() {
+		{
+			lock_guard<mutex> lock{ worker_mutex };
+			stopping = true;
+		}
+		start_cv.notify_all();
+		for (auto iter = workers.begin(); iter != workers.end(); ++iter) {
+			iter->join();
+		}
+	}
+
+	int64_t rows() const { return matrix_rows; }
+	int64_t cols() const { return matrix_cols; }
+
+	int shard_count() const { return (int)shards.size(); }
+	int64_t get_shard_begin(int shard) const { return shard_begin[shard]; }
+	int64_t get_shard_end(int shard) const { return shard_end[shard]; }
+	ShardType &get_shard(int shard) { return *shards[shard]; }
+
+	// the shard that holds a row
+	int find_shard(int64_t row_ptr) const {
+		return (int)(upper_bound(shard_end.begin(), shard_end.end(), row_ptr) - shard_end.begin());
+	}
+
+	MatrixType read_row(int64_t row_ptr) {
+		MatrixType ret{ 1,matrix_cols };
+		read_row(row_ptr, ret);
+		return ret;
+	}
+
+	void read_row(int64_t row_ptr, MatrixType &ret) {
+		auto shard = find_shard(row_ptr);
+		shards[shard]->read_row(row_ptr - shard_begin[shard], ret);
+	}
+
+	void write_row(const MatrixType &matrix, int64_t row_ptr) {
+		auto shard = find_shard(row_ptr);
+		shards[shard]->write_row(matrix, row_ptr - shard_begin[shard]);
+	}
+
+	void flush() {
+		for (auto iter = shards.begin(); iter != shards.end(); ++iter) {
+			(*iter)->flush();
+		}
+	}
+
+	// run task(shard) on the worker of every shard and wait for all of them
+	// the first exception thrown by a task is rethrown here
+	void for_each_shard(const TaskType &task) {
+		unique_lock<mutex> lock{ worker_mutex };
+		current_task = &task;
+		pending = (int)workers.size();
+		task_error = nullptr;
+		++generation;
+		start_cv.notify_all();
+		done_cv.wait(lock, [this]() { return pending == 0; });
+		current_task = nullptr;
+
+		if (task_error)rethrow_exception(task_error);
+	}
+
+	// fill this matrix with the transpose of a matrix file, each worker reads
+	// the source through its own stream and writes the rows of its shard
+	// a worker builds its rows in batches of at most transpose_batch_elements
+	// elements: it reads the columns of the batch from every source row, transposes
+	// them in memory and writes whole rows; each worker also verifies its share of
+	// the source blocks, so unless a shard needs several batches the source is
+	// read about twice in total however many shards there are
+	void fill_with_transpose_of(const string &filename) {
+		for_each_shard([&](int shard) {
+			ShardType source{ filename };
+			expr_check(source.rows() == matrix_cols && source.cols() == matrix_rows, "the size of the source matrix does not match.");
+			source.verify_blocks(shard, shard_count());
+
+			auto &target = *shards[shard];
+			auto begin = shard_begin[shard];
+			auto end = shard_end[shard];
+			auto batch_rows = max((int64_t)1, transpose_batch_elements / max(matrix_cols, (int64_t)1));
+			MatrixType row{ 1,matrix_cols };
+			for (auto batch_begin = begin; batch_begin < end; batch_begin += batch_rows) {
+				auto batch_end = min(end, batch_begin + batch_rows);
+				MatrixType batch{ batch_end - batch_begin,matrix_cols };
+				MatrixType piece{ 1,batch_end - batch_begin };
+				for (int64_t i = 0; i < matrix_cols; ++i) {
+					source.read_row_range(i, batch_begin, piece, false);
+					batch.col(i) = piece.transpose();
+				}
+				for (auto j = batch_begin; j < batch_end; ++j) {
+					row = batch.row(j - batch_begin);
+					target.write_row(row, j - begin);
+				}
+			}
+			target.flush();
+		});
+	}
+
+protected:
+	// memory budget of fill_with_transpose_of() for each worker
+	static constexpr int64_t transpose_batch_elements = (int64_t)1 << 21;
+
+	int64_t matrix_rows = 0;
+	int64_t matrix_cols = 0;
+	vector<unique_ptr<ShardType>> shards;
+	// rows [shard_begin[i], shard_end[i]) are stored in shards[i]
+	vector<int64_t> shard_begin;
+	vector<int64_t> shard_end;
+
+	vector<thread> workers;
+	mutex worker_mutex;
+	condition_variable start_cv;
+	condition_variable done_cv;
+	const TaskType *current_task = nullptr;
+	int64_t generation = 0;
+	int pending = 0;
+	bool stopping = false;
+	exception_ptr task_error;
+
+	void start_workers() {
+		for (auto i = 0; i < shard_count(); ++i) {
+			workers.emplace_back([this, i]() { worker_loop(i); });
+		}
+	}
+
+	void worker_loop(int shard) {
+		int64_t seen_generation = 0;
+		while (true) {
+			const TaskType *task;
+			{
+				unique_lock<mutex> lock{ worker_mutex };
+				start_cv.wait(lock, [&]() { return stopping || generation != seen_generation; });
+				if (stopping)return;
+				seen_generation = generation;
+				task = current_task;
+			}
+
+			exception_ptr error;
+			try {
+				(*task)(shard);
+			}
+			catch (...) {
+				error = current_exception();
+			}
+
+			{
+				lock_guard<mutex> lock{ worker_mutex };
+				if (error && !task_error)task_error = error;
+				if (--pending == 0)done_cv.notify_all();
+			}
+		}
+	}
+};
+
+
+#endif // !DEF_SHARDEDONDISKMATRIX_HPP
@@ -3,6 +3,8 @@
 
 #include "__include.hpp"
 #include "OnDiskMatrix.hpp"
+#include "SparseBasisInverse.hpp"
+#include "ShardedOnDiskMatrix.hpp"
 
 struct InfiniteSolutionsError :public exception {
 	using exception::exception;
@@ -12,22 +14,138 @@ struct NoSolutionError :public exception {
 	using exception::exception;
 };
 
-template<typename V>
+struct SolveCancelledError :public exception {
+	using exception::exception;
+};
+
+// rule used to choose the variable that goes into the base
+enum class PricingRule {
+	// largest reduced cost
+	dantzig,
+	// smallest index with a positive reduced cost, does not cycle
+	bland,
+	// largest reduced cost divided by the norm of the column
+	normalized
+};
+
+// shared flag used to stop a solver between two pivots
+// copies of a token refer to the same flag
+class CancellationToken {
+public:
+	CancellationToken() :flag{ make_shared<atomic<bool>>(false) } {}
+
+	void cancel() { flag->store(true); }
+	bool is_cancelled() const { return flag->load(memory_order_relaxed); }
+
+private:
+	shared_ptr<atomic<bool>> flag;
+};
+
+// limits of SimplexMethod::solve_with_limits(), checked between two pivots
+struct SolveLimits {
+	// wall time in seconds
+	double time_limit = numeric_limits<double>::infinity();
+	int64_t iteration_limit = numeric_limits<int64_t>::max();
+	// seconds between two calls of the progress callback
+	double progress_interval = 1.0;
+};
+
+enum class SolveStatus {
+	optimal,
+	infeasible,
+	unbounded,
+	// the solve stopped early, the result holds the current basic solution
+	time_limit,
+	iteration_limit,
+	cancelled
+};
+
+// V is the type used in computation, S is the type of the matrix stored on disk
+// (e.g. a float matrix can be solved in double precision, halving the I/O)
+template<typename V, typename S = V>
 class SimplexMethod {
 public:
 	using value_type = V;
+	using storage_type = S;
 	using const_reference = const V&;
 	using reference = V&;
-	using DiskMatrixType = OnDiskMatrix<value_type>;
+	using DiskMatrixType = OnDiskMatrix<storage_type>;
+	using DiskRowType = typename DiskMatrixType::MatrixType;
+	using ShardedMatrixType = ShardedOnDiskMatrix<storage_type>;
 	using SparseMatrixType = Eigen::SparseMatrix<value_type>;
+	using SparseVectorType = Eigen::SparseVector<value_type>;
+	using BasisInverseType = SparseBasisInverse<value_type>;
 	using DenseMatrixType = Eigen::Matrix<value_type, -1, -1>;
 	using SolutionType = map<int, value_type>;
 
+	// columns generated at run time, each with its objective coefficient
+	using ColumnBatchType = vector<pair<SparseVectorType, value_type>>;
+	// receives the current duals (1 x rows) and appends attractive columns to the
+	// batch, i.e. columns a with cost c such that c - duals * a > 0
+	using PricingCallbackType = function<void(const DenseMatrixType&, ColumnBatchType&)>;
+
+	struct SolveProgress {
+		int64_t iterations;
+		// seconds since the solve started
+		double elapsed;
+		// iterations per second
+		double iteration_rate;
+		// objective of the original problem at the current basis
+		value_type objective;
+		// sum of the artificial variables in the base, 0 once the basis is feasible
+		value_type infeasibility;
+	};
+	using ProgressCallbackType = function<void(const SolveProgress&)>;
+
+	struct SolveResult {
+		SolveStatus status;
+		// the optimal solution, or the current basic solution if the solve stopped
+		// early (it is only feasible if infeasibility is 0)
+		SolutionType solution;
+		value_type objective;
+		value_type infeasibility;
+		int64_t iterations;
+	};
+
+	// result of solve_async(), the solver must outlive the handle
+	class SolveHandle {
+	public:
+		SolveHandle(future<SolveResult> &&_result, const CancellationToken &_token)
+			:result{ move(_result) }, token{ _token } {}
+
+		// the solve stops after the current pivot and returns the current basis
+		void cancel() { token.cancel(); }
+
+		bool is_ready() const { return result.wait_for(chrono::seconds{ 0 }) == future_status::ready; }
+		void wait() const { result.wait(); }
+
+		// returns true if the solve finished within the duration
+		template<typename Rep, typename Period>
+		bool wait_for(const chrono::duration<Rep, Period> &duration) const {
+			return result.wait_for(duration) == future_status::ready;
+		}
+
+		// waits for the result, can only be called once
+		// errors other than infeasibility or unboundedness are rethrown here
+		SolveResult get() { return result.get(); }
+
+	private:
+		future<SolveResult> result;
+		CancellationToken token;
+	};
+
 	// run simplex method with original matrix
 	SimplexMethod(const string &filename, const DenseMatrixType &_vec_b, const DenseMatrixType &_vec_c) {
 		init_not_extended(filename,_vec_b,_vec_c);
 	}
 
+	// run simplex method with the columns of the extended matrix split across
+	// several files (e.g. one per device), setup and pricing read them in parallel
+	SimplexMethod(const string &filename, const DenseMatrixType &_vec_b, const DenseMatrixType &_vec_c,
+		const vector<string> &shard_files) {
+		init_not_extended(filename,_vec_b,_vec_c,shard_files);
+	}
+
 	/*
 	// NOT IMPLEMENTED YET
 	// run simplex method with matrix with artificial variables already
@@ -38,40 +156,298 @@ public:
 	}
 	*/
 
+	// solve the same problem as another solver, sharing its extended matrix
+	// on disk (opened through a new stream) and starting from its current basis
+	SimplexMethod(const SimplexMethod &other, PricingRule rule) {
+		init_shared(other);
+		pricing_rule = rule;
+	}
+
 	// returns the map of solutions, set val to be the maximum value
 	SolutionType solve(value_type &val) {
 		auto run = 0;
 		while (!run_once()) {
-			cout << "running iteration :" << (run++) << "\n";
+			if (cancellation.is_cancelled())throw SolveCancelledError{ "solving cancelled" };
+			if (verbose)cout << "running iteration :" << (run++) << "\n";
 		}
 
-		cout << "solving finished.\n";
-		// generate solution map
-		SolutionType sol;
-		auto x_b = get_x_b_vec();
-		for (auto i = 0; i < x_b.rows(); ++i) {
-			sol.insert(SolutionType::value_type{base[i],x_b(i,0)});
+		if (verbose)cout << "solving finished.\n";
+		proven_optimal = true;
+		return get_solution(val);
+	}
+
+	// solve within the limits, the cancellation token and the limits are checked
+	// between two pivots; infeasibility and unboundedness are reported in the status
+	SolveResult solve_with_limits(const SolveLimits &limits, const ProgressCallbackType &progress = nullptr) {
+		return solve_with_limits(limits, progress, CancellationToken{});
+	}
+
+	// run solve_with_limits() on a new thread, the handle cancels this solve only
+	// (through a token of its own, the token of the solver is still checked)
+	SolveHandle solve_async(const SolveLimits &limits = SolveLimits{}, const ProgressCallbackType &progress = nullptr) {
+		CancellationToken token;
+		return SolveHandle{ async(launch::async, [this, limits, progress, token]() {
+			return solve_with_limits(limits, progress, token);
+		}), token };
+	}
+
+	// call_cancellation stops this call only, in addition to the token of the solver
+	SolveResult solve_with_limits(const SolveLimits &limits, const ProgressCallbackType &progress,
+		const CancellationToken &call_cancellation) {
+		SolveResult ret;
+		ret.iterations = 0;
+
+		auto start = chrono::steady_clock::now();
+		auto last_report = start;
+		auto seconds_since = [](chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+			return chrono::duration<double>(to - from).count();
+		};
+
+		bool finished = false;
+		try {
+			while (true) {
+				auto now = chrono::steady_clock::now();
+				if (progress && seconds_since(last_report, now) >= limits.progress_interval) {
+					progress(get_progress(ret.iterations, seconds_since(start, now)));
+					last_report = now;
+				}
+
+				// the callback may cancel the solve too
+				if (cancellation.is_cancelled() || call_cancellation.is_cancelled()) {
+					ret.status = SolveStatus::cancelled;
+					break;
+				}
+				if (ret.iterations >= limits.iteration_limit) {
+					ret.status = SolveStatus::iteration_limit;
+					break;
+				}
+				if (seconds_since(start, now) >= limits.time_limit) {
+					ret.status = SolveStatus::time_limit;
+					break;
+				}
+
+				if (run_once()) {
+					finished = true;
+					break;
+				}
+				++ret.iterations;
+			}
+		}
+		catch (const InfiniteSolutionsError&) {
+			ret.status = SolveStatus::unbounded;
 		}
 
-		// not the most efficient way to get z though...
-		val = get_z();
-		return sol;
+		if (finished) {
+			try {
+				ret.solution = get_solution(ret.objective);
+				ret.status = SolveStatus::optimal;
+			}
+			catch (const NoSolutionError&) {
+				ret.status = SolveStatus::infeasible;
+			}
+		}
+		proven_optimal = ret.status == SolveStatus::optimal;
+		if (!proven_optimal) {
+			ret.solution = get_current_solution(ret.objective);
+		}
+		ret.infeasibility = get_infeasibility();
+
+		if (progress)progress(get_progress(ret.iterations, seconds_since(start, chrono::steady_clock::now())));
+		return ret;
+	}
+
+	void set_pricing_rule(PricingRule rule) { pricing_rule = rule; }
+	PricingRule get_pricing_rule() const { return pricing_rule; }
+
+	// solve() throws SolveCancelledError after the pivot in which the token is cancelled
+	void set_cancellation_token(const CancellationToken &token) { cancellation = token; }
+
+	// print the progress of solve(), solve_column_generation() and solve_sifting() to cout
+	void set_verbose(bool _verbose) { verbose = _verbose; }
+
+	// restricted master mode: solve over the current columns, pass the duals to
+	// the pricing callback, add the columns it returns and re-optimize from the
+	// current basis, until the callback returns no column or max_rounds is reached
+	// (see is_proven_optimal())
+	SolutionType solve_column_generation(value_type &val, const PricingCallbackType &pricing,
+		int max_rounds = numeric_limits<int>::max()) {
+		ColumnBatchType new_columns;
+		proven_optimal = false;
+		for (auto round = 0; round < max_rounds; ++round) {
+			auto run = 0;
+			while (!run_once()) {
+				++run;
+			}
+			if (verbose)cout << "column generation round " << round << ": " << run << " iterations, "
+				<< column_count() << " columns.\n";
+
+			new_columns.clear();
+			pricing(get_duals(), new_columns);
+			if (new_columns.empty()) {
+				proven_optimal = true;
+				break;
+			}
+			add_columns(new_columns);
+		}
+
+		if (verbose)cout << "solving finished.\n";
+		return get_solution(val);
+	}
+
+	// sifting mode for problems with far more columns than rows: the simplex
+	// iterations only price a RAM-resident working set of columns, and the full
+	// set is priced in one sequential pass between rounds, adding at most
+	// working_set_size of the most attractive columns to the working set
+	// max_rounds limits the number of rounds (see is_proven_optimal())
+	SolutionType solve_sifting(value_type &val, int working_set_size,
+		int max_rounds = numeric_limits<int>::max()) {
+		expr_check(working_set_size > 0, "invalid working set size");
+		resident_slot.assign(column_count(), -1);
+		resident_cols.clear();
+		free_slots.clear();
+
+		// the working set starts empty, every non-basic column comes from the first pass
+		non_base.clear();
+		full_pricing_passes = 0;
+		proven_optimal = false;
+
+		for (auto round = 0; round < max_rounds; ++round) {
+			if (!add_attractive_columns(working_set_size)) {
+				proven_optimal = true;
+				break;
+			}
+			workspace.sigma.resize(1, non_base.size());
+
+			auto run = 0;
+			while (!run_once()) {
+				++run;
+			}
+			if (verbose)cout << "sifting round " << round << ": " << run << " iterations, "
+				<< non_base.size() << " columns in the working set.\n";
+		}
+
+		// leave every column non-basic again, so that the other solving modes still work
+		vector<bool> in_base(column_count(), false);
+		for (auto iter = base.begin(); iter != base.end(); ++iter) {
+			in_base[*iter] = true;
+		}
+		non_base.clear();
+		for (auto i = 0; i < column_count(); ++i) {
+			if (!in_base[i])non_base.push_back(i);
+		}
+		workspace.sigma.resize(1, non_base.size());
+		resident_slot.clear();
+		resident_cols.clear();
+		free_slots.clear();
+
+		if (verbose)cout << "solving finished, " << full_pricing_passes << " full pricing passes.\n";
+		return get_solution(val);
+	}
+
+	int get_full_pricing_passes() const { return full_pricing_passes; }
+
+	// false if the last solve stopped at max_rounds while some columns could still
+	// improve the objective, the solution is then only optimal over the columns used so far
+	bool is_proven_optimal() const { return proven_optimal; }
+
+	// append columns to the in-memory pool as non-basic variables
+	// returns the index of the first new column in the solution map
+	int add_columns(const ColumnBatchType &columns) {
+		// check the whole batch first, so that a bad column leaves the solver unchanged
+		for (auto iter = columns.begin(); iter != columns.end(); ++iter) {
+			expr_check(iter->first.size() == B_inv.size(), "the size of the new column does not match");
+		}
+
+		auto first = column_count();
+		vec_c.conservativeResize(1, first + (int)columns.size());
+		for (auto iter = columns.begin(); iter != columns.end(); ++iter) {
+			vec_c(0, column_count()) = iter->second;
+			non_base.push_back(column_count());
+			column_pool.push_back(iter->first);
+			if (!resident_slot.empty())resident_slot.push_back(-1);
+			if (!column_norms.empty())column_norms.push_back(iter->first.norm());
+		}
+		workspace.sigma.resize(1, non_base.size());
+		return first;
+	}
+
+	// simplex multipliers c_b * B_inv of the current basis
+	const DenseMatrixType &get_duals() {
+		recompute_pi_and_x_b();
+		return vec_pi;
+	}
+
+	// number of columns of the extended matrix, including artificial and pooled ones
+	int column_count() const {
+		return (int)stored_column_count() + (int)column_pool.size();
 	}
 
+	// number of iterative refinement steps applied to the final x_b
+	void set_refinement_steps(int steps) { refinement_steps = steps; }
+
 protected:
 	using TripletType = Eigen::Triplet<value_type>;
 	unique_ptr<DiskMatrixType> ondisk_mat;
 	unique_ptr<DiskMatrixType> ondisk_trans;
+	// replaces ondisk_trans when the columns are sharded
+	unique_ptr<ShardedMatrixType> sharded_trans;
+	// file of ondisk_trans, or manifest of sharded_trans
+	string trans_filename;
+	typename ShardedMatrixType::TaskType sharded_pricing_task;
 	DenseMatrixType vec_b;
 	DenseMatrixType vec_c;
-	SparseMatrixType B_inv;
+	BasisInverseType B_inv;
 	vector<int> base;
 	vector<int> non_base;
+	int refinement_steps = 2;
+	PricingRule pricing_rule = PricingRule::dantzig;
+	// norms of the columns, only computed for the normalized pricing rule
+	vector<value_type> column_norms;
+	CancellationToken cancellation;
+	bool verbose = true;
+	bool proven_optimal = false;
+
+	// [artificial_begin, artificial_begin + rows) are the artificial variables
+	int artificial_begin = 0;
+	// columns added at run time, numbered after the columns on disk
+	vector<SparseVectorType> column_pool;
+
+	// working set of the sifting mode, resident_slot[col] is the position of
+	// the column in resident_cols or -1 (empty when not sifting)
+	vector<int> resident_slot;
+	vector<SparseVectorType> resident_cols;
+	vector<int> free_slots;
+	int full_pricing_passes = 0;
+
+	// simplex multipliers c_b * B_inv and basic solution B_inv * b, both updated
+	// after each pivot with sparse vectors and recomputed every few pivots
+	DenseMatrixType vec_pi;
+	DenseMatrixType vec_x_b;
+	int pivots_since_recompute = 0;
+	static constexpr int recompute_interval = 100;
+
+	// buffers reused by every iteration, sized once in init_workspace() so that
+	// the solving loop itself does not touch the heap
+	struct IterationWorkspace {
+		DiskRowType disk_row;
+		SparseVectorType p_k;
+		SparseVectorType y_k;
+		SparseVectorType c_b;
+		SparseVectorType b;
+		SparseVectorType result;
+		DenseMatrixType sigma;
+		// one row buffer and column per shard, used by the I/O workers
+		vector<DiskRowType> shard_rows;
+		vector<SparseVectorType> shard_cols;
+	} workspace;
+
+	// initial room in the pool of B_inv, in nonzeros per row and column
+	static constexpr int basis_reserve_per_vector = 64;
 
 
 	template<typename K>
 	typename vector<K>::size_type guaranteed_sequencial_find(const vector<K> &vec, const K &target) {
-		using size_t = vector<K>::size_type;
+		using size_t = typename vector<K>::size_type;
 		size_t pos = 0;
 		for (; pos < vec.size(); ++pos) {
 			if (vec[pos] == target)return pos;
@@ -81,7 +457,7 @@ protected:
 
 	template<typename K>
 	typename vector<K>::size_type guaranteed_find_max(const vector<K> &vec) {
-		using size_t = vector<K>::size_type;
+		using size_t = typename vector<K>::size_type;
 		size_t pos = 0;
 		K value = vec[pos];
 
@@ -96,11 +472,127 @@ protected:
 	}
 
 	value_type get_z() {
-		return (get_c_b_vec() * B_inv * vec_b)(0, 0);
+		return (get_c_b_vec() * vec_x_b)(0, 0);
 	}
 
 	DenseMatrixType get_x_b_vec() {
-		return B_inv * vec_b;
+		return vec_x_b;
+	}
+
+	// number of columns of the extended matrix stored on disk
+	int64_t stored_column_count() const {
+		return sharded_trans ? sharded_trans->rows() : ondisk_trans->rows();
+	}
+
+	bool is_on_disk(int col_ptr) const {
+		return col_ptr < stored_column_count() && (resident_slot.empty() || resident_slot[col_ptr] < 0);
+	}
+
+	// read a column of the extended matrix, widened to the computation type
+	void read_column(int col_ptr, SparseVectorType &ret) {
+		read_column(col_ptr, ret, workspace.disk_row);
+	}
+
+	// row is the buffer used to read from disk
+	void read_column(int col_ptr, SparseVectorType &ret, DiskRowType &row) {
+		if (!resident_slot.empty() && resident_slot[col_ptr] >= 0) {
+			ret = resident_cols[resident_slot[col_ptr]];
+			return;
+		}
+		if (col_ptr >= stored_column_count()) {
+			ret = column_pool[col_ptr - stored_column_count()];
+			return;
+		}
+
+		if (sharded_trans)sharded_trans->read_row(col_ptr, row);
+		else ondisk_trans->read_row(col_ptr, row);
+		ret.resize(row.cols());
+		for (auto i = 0; i < row.cols(); ++i) {
+			if (row(0, i) != (storage_type)0)ret.insertBack(i) = (value_type)row(0, i);
+		}
+	}
+
+	void to_sparse_vector(const DenseMatrixType &vec, SparseVectorType &ret) {
+		ret.resize(vec.size());
+		for (auto i = 0; i < vec.size(); ++i) {
+			if (vec(i) != (value_type)0)ret.insertBack(i) = vec(i);
+		}
+	}
+
+	// recompute pi and x_b from B_inv to get rid of the accumulated update error
+	void recompute_pi_and_x_b() {
+		auto &c_b = workspace.c_b;
+		c_b.resize(base.size());
+		for (auto i = 0; i < (int)base.size(); ++i) {
+			if (vec_c(0, base[i]) != (value_type)0)c_b.insertBack(i) = vec_c(0, base[i]);
+		}
+
+		auto &result = workspace.result;
+		B_inv.btran(c_b, result);
+		vec_pi.setZero();
+		for (typename SparseVectorType::InnerIterator it(result); it; ++it) {
+			vec_pi(0, it.index()) = it.value();
+		}
+
+		B_inv.ftran(workspace.b, result);
+		vec_x_b.setZero();
+		for (typename SparseVectorType::InnerIterator it(result); it; ++it) {
+			vec_x_b(it.index(), 0) = it.value();
+		}
+		pivots_since_recompute = 0;
+	}
+
+	void init_workspace() {
+		auto rows = B_inv.size();
+		workspace.disk_row.resize(1, rows);
+		workspace.p_k.resize(rows);
+		workspace.p_k.reserve(rows);
+		workspace.y_k.resize(rows);
+		workspace.y_k.reserve(rows);
+		workspace.c_b.resize(rows);
+		workspace.c_b.reserve(rows);
+		workspace.result.resize(rows);
+		workspace.result.reserve(rows);
+		to_sparse_vector(vec_b, workspace.b);
+		workspace.sigma.resize(1, non_base.size());
+
+		if (sharded_trans) {
+			workspace.shard_rows.assign(sharded_trans->shard_count(), DiskRowType{ 1,rows });
+			workspace.shard_cols.assign(sharded_trans->shard_count(), SparseVectorType{ rows });
+			for (auto iter = workspace.shard_cols.begin(); iter != workspace.shard_cols.end(); ++iter) {
+				iter->reserve(rows);
+			}
+			sharded_pricing_task = [this](int shard) { price_shard(shard); };
+		}
+
+		vec_pi.resize(1, rows);
+		vec_x_b.resize(rows, 1);
+		B_inv.reserve(min(rows, basis_reserve_per_vector));
+	}
+
+	// iterative refinement: x_b += B_inv * (b - B * x_b)
+	// B is rebuilt from the stored columns, so the residual is computed against
+	// the exact matrix on disk rather than the accumulated product form of B_inv
+	DenseMatrixType refine_x_b_vec(DenseMatrixType x_b) {
+		for (auto step = 0; step < refinement_steps; ++step) {
+			DenseMatrixType residual = vec_b;
+			SparseVectorType column;
+			for (auto i = 0; i < (int)base.size(); ++i) {
+				read_column(base[i], column);
+				residual -= column * x_b(i, 0);
+			}
+
+			SparseVectorType sparse_residual, delta;
+			to_sparse_vector(residual, sparse_residual);
+			B_inv.ftran(sparse_residual, delta);
+			value_type max_delta = 0;
+			for (typename SparseVectorType::InnerIterator it(delta); it; ++it) {
+				x_b(it.index(), 0) += it.value();
+				max_delta = max(max_delta, abs(it.value()));
+			}
+			if (max_delta <= numeric_limits<value_type>::epsilon() * x_b.cwiseAbs().maxCoeff())break;
+		}
+		return x_b;
 	}
 
 	DenseMatrixType get_c_n_vec() {
@@ -121,116 +613,335 @@ protected:
 		return ret;
 	}
 
-	DenseMatrixType get_sigma_vec() {
-		DenseMatrixType ret{ 1,non_base.size() };
-		
+	// reduced cost c_j - pi * a_j of a column
+	value_type price_column(int col_ptr, SparseVectorType &col, DiskRowType &row) {
+		read_column(col_ptr, col, row);
+		value_type product = 0;
+		for (typename SparseVectorType::InnerIterator it(col); it; ++it) {
+			product += vec_pi(0, it.index()) * it.value();
+		}
+		return vec_c(0, col_ptr) - product;
+	}
 
-		auto c_b{ move(get_c_b_vec()) };
-		auto c_n{ move(get_c_n_vec()) };
+	// price the non-basic columns stored in one shard, run by its I/O worker
+	void price_shard(int shard) {
+		auto begin = sharded_trans->get_shard_begin(shard);
+		auto end = sharded_trans->get_shard_end(shard);
+		auto &ret = workspace.sigma;
+		for (auto i = 0; i < (int)non_base.size(); ++i) {
+			auto col_ptr = non_base[i];
+			if (col_ptr < begin || col_ptr >= end || !is_on_disk(col_ptr))continue;
+			ret(0, i) = price_column(col_ptr, workspace.shard_cols[shard], workspace.shard_rows[shard]);
+		}
+	}
+
+	// sigma = c_n - pi * N, written into the workspace
+	const DenseMatrixType &get_sigma_vec() {
+		auto &ret = workspace.sigma;
+		auto &col = workspace.p_k;
+
+		// with sharded columns, the workers price the columns on disk in parallel
+		// and only the columns held in memory are left here
+		if (sharded_trans)sharded_trans->for_each_shard(sharded_pricing_task);
 
-		DenseMatrixType product_row = c_b * B_inv;
-		
 		auto i = 0;
 		for (auto iter = non_base.begin(); iter != non_base.end(); ++iter,++i) {
-			auto col = ondisk_trans->read_row(*iter);;
-			col.transposeInPlace();
-			ret(0, i) = (product_row * col)(0, 0);
+			if (sharded_trans && is_on_disk(*iter))continue;
+			ret(0, i) = price_column(*iter, col, workspace.disk_row);
 		}
 
-		return c_n - ret;
+		return ret;
 	}
 
-	void base_alteration(int out_pos, int in_pos, const DenseMatrixType &y_k) {
-		value_type major_element = y_k(out_pos,0);
+	// sigma_k is the reduced cost of the entering variable
+	void base_alteration(int out_pos, int in_pos, const SparseVectorType &y_k, value_type sigma_k) {
+		value_type major_element = y_k.coeff(out_pos);
 
-		vector<TripletType> elements;
-		
-		// add elements that are in the major column
-		for (auto i = 0; i < B_inv.rows(); ++i) {
-			if (i == out_pos)elements.emplace_back(TripletType{ i, out_pos, (value_type)1 / major_element });
-			else elements.emplace_back(TripletType{ i, out_pos, -y_k(i,0) / major_element });
+		// pi' = pi + sigma_k / y_rk * (row r of B_inv)
+		value_type pi_ratio = sigma_k / major_element;
+		for (typename BasisInverseType::InnerIterator it(B_inv.row(out_pos)); it; ++it) {
+			vec_pi(0, it.index()) += pi_ratio * it.value();
 		}
 
-		// add elements in the rest of columns
-		for (auto i = 0; i < B_inv.cols(); ++i) {
-			if (i != out_pos)elements.emplace_back(TripletType{ i,i,(value_type)1});
+		// x_b' = x_b - theta * y_k, and the entering variable takes theta
+		value_type theta = vec_x_b(out_pos, 0) / major_element;
+		for (typename SparseVectorType::InnerIterator it(y_k); it; ++it) {
+			vec_x_b(it.index(), 0) -= theta * it.value();
 		}
+		vec_x_b(out_pos, 0) = theta;
 
-		// form the E matrix
-		SparseMatrixType mat_e{ B_inv.rows(),B_inv.cols() };
-		mat_e.setFromTriplets(elements.begin(), elements.end());
-
-		B_inv = (mat_e * B_inv).eval();
+		B_inv.update(out_pos, y_k);
 
 		// set the base vectors
 		auto out = base[out_pos];
 		base[out_pos] = non_base[in_pos];
 		non_base[in_pos] = out;
+
+		// the leaving column joins the working set of the sifting mode
+		if (!resident_slot.empty())load_column(out);
+
+		if (++pivots_since_recompute >= recompute_interval)recompute_pi_and_x_b();
 	}
 
-	bool run_once() {
-		// optimal condition check
-		bool optimal = true;
-		auto sigma_vec = get_sigma_vec();
+	// price every column outside the working set in one sequential pass and move
+	// up to count of the most attractive ones into it, evicting the least
+	// attractive non-basic columns of the working set to keep its size bounded
+	// returns false if no column outside the working set is attractive
+	bool add_attractive_columns(int count) {
+		recompute_pi_and_x_b();
+		++full_pricing_passes;
 
-		for (auto i = 0; i < sigma_vec.cols(); ++i) {
-			if (sigma_vec(0, i) > mach_eps) {
-				optimal = false;
-				break;
+		vector<bool> in_working_set(column_count(), false);
+		for (auto iter = base.begin(); iter != base.end(); ++iter) {
+			in_working_set[*iter] = true;
+		}
+		for (auto iter = non_base.begin(); iter != non_base.end(); ++iter) {
+			in_working_set[*iter] = true;
+		}
+
+		// min-heap of (reduced cost, column) holding the best candidates so far
+		using CandidateType = pair<value_type, int>;
+		vector<CandidateType> candidates;
+		candidates.reserve(count + 1);
+		auto &col = workspace.p_k;
+		for (auto i = 0; i < column_count(); ++i) {
+			if (in_working_set[i])continue;
+			read_column(i, col);
+			value_type sigma = vec_c(0, i);
+			for (typename SparseVectorType::InnerIterator it(col); it; ++it) {
+				sigma -= vec_pi(0, it.index()) * it.value();
+			}
+			if (sigma <= mach_eps)continue;
+
+			candidates.emplace_back(sigma, i);
+			push_heap(candidates.begin(), candidates.end(), greater<CandidateType>{});
+			if ((int)candidates.size() > count) {
+				pop_heap(candidates.begin(), candidates.end(), greater<CandidateType>{});
+				candidates.pop_back();
 			}
 		}
+		if (candidates.empty())return false;
 
-		if (optimal) {
-			// make sure no artificial variable is in the base
-			for (auto iter = base.begin(); iter != base.end(); ++iter) {
-				if (*iter >= B_inv.rows())throw NoSolutionError{ "no solution" };
+		// evict the non-basic columns with the lowest reduced costs
+		auto limit = 2 * count;
+		if ((int)(non_base.size() + candidates.size()) > limit && !non_base.empty()) {
+			vector<CandidateType> current;
+			for (auto iter = non_base.begin(); iter != non_base.end(); ++iter) {
+				read_column(*iter, col);
+				value_type sigma = vec_c(0, *iter);
+				for (typename SparseVectorType::InnerIterator it(col); it; ++it) {
+					sigma -= vec_pi(0, it.index()) * it.value();
+				}
+				current.emplace_back(sigma, *iter);
 			}
-			return true;
+			sort(current.begin(), current.end(), greater<CandidateType>{});
+
+			auto keep = max(0, limit - (int)candidates.size());
+			non_base.clear();
+			for (auto i = 0; i < (int)current.size(); ++i) {
+				if (i < keep)non_base.push_back(current[i].second);
+				else release_column(current[i].second);
+			}
+		}
+
+		for (auto iter = candidates.begin(); iter != candidates.end(); ++iter) {
+			load_column(iter->second);
+			non_base.push_back(iter->second);
 		}
+		return true;
+	}
 
+	// copy a column into the working set
+	void load_column(int col_ptr) {
+		if (resident_slot[col_ptr] >= 0)return;
+		int slot;
+		if (free_slots.empty()) {
+			slot = (int)resident_cols.size();
+			resident_cols.emplace_back();
+		}
+		else {
+			slot = free_slots.back();
+			free_slots.pop_back();
+		}
+		read_column(col_ptr, resident_cols[slot]);
+		resident_slot[col_ptr] = slot;
+	}
 
-		// find the one that should go into base
-		auto into_base = 0;
-		value_type max_val = sigma_vec(0, 0);
-		for (auto i = 1; i < sigma_vec.cols(); ++i) {
-			if (sigma_vec(0, i) > max_val) {
-				into_base = i;
-				max_val = sigma_vec(0, i);
+	void release_column(int col_ptr) {
+		if (resident_slot[col_ptr] < 0)return;
+		free_slots.push_back(resident_slot[col_ptr]);
+		resident_slot[col_ptr] = -1;
+	}
+
+	bool is_artificial(int col_ptr) const {
+		return col_ptr >= artificial_begin && col_ptr < artificial_begin + B_inv.size();
+	}
+
+	// basic solution of the current basis without the artificial variables
+	// (it is not refined), set val to be the objective of the original problem
+	SolutionType get_current_solution(value_type &val) {
+		SolutionType sol;
+		for (auto i = 0; i < (int)base.size(); ++i) {
+			if (!is_artificial(base[i]))sol.insert(typename SolutionType::value_type{ base[i],vec_x_b(i,0) });
+		}
+		val = get_current_objective();
+		return sol;
+	}
+
+	value_type get_current_objective() const {
+		value_type ret = 0;
+		for (auto i = 0; i < (int)base.size(); ++i) {
+			if (!is_artificial(base[i]))ret += vec_c(0, base[i]) * vec_x_b(i, 0);
+		}
+		return ret;
+	}
+
+	value_type get_infeasibility() const {
+		value_type ret = 0;
+		for (auto i = 0; i < (int)base.size(); ++i) {
+			if (is_artificial(base[i]) && vec_x_b(i, 0) > mach_eps)ret += vec_x_b(i, 0);
+		}
+		return ret;
+	}
+
+	SolveProgress get_progress(int64_t iterations, double elapsed) {
+		SolveProgress ret;
+		ret.iterations = iterations;
+		ret.elapsed = elapsed;
+		ret.iteration_rate = elapsed > 0 ? iterations / elapsed : 0;
+		ret.objective = get_current_objective();
+		ret.infeasibility = get_infeasibility();
+		return ret;
+	}
+
+	// generate the solution map from the current basis, set val to be the objective value
+	SolutionType get_solution(value_type &val) {
+		// make sure no artificial variable is in the base at a positive level
+		for (auto i = 0; i < (int)base.size(); ++i) {
+			if (is_artificial(base[i]) && vec_x_b(i, 0) > mach_eps)throw NoSolutionError{ "no solution" };
+		}
+
+		SolutionType sol;
+		auto x_b = refine_x_b_vec(get_x_b_vec());
+		for (auto i = 0; i < x_b.rows(); ++i) {
+			sol.insert(typename SolutionType::value_type{base[i],x_b(i,0)});
+		}
+
+		val = (get_c_b_vec() * x_b)(0, 0);
+		return sol;
+	}
+
+	// position in non_base of the variable that goes into the base, sigma has a positive entry
+	int choose_entering(const DenseMatrixType &sigma_vec) {
+		auto into_base = -1;
+		value_type best = 0;
+
+		if (pricing_rule == PricingRule::normalized && column_norms.empty())compute_column_norms();
+
+		for (auto i = 0; i < sigma_vec.cols(); ++i) {
+			if (sigma_vec(0, i) <= mach_eps)continue;
+
+			switch (pricing_rule) {
+			case PricingRule::dantzig:
+				if (into_base < 0 || sigma_vec(0, i) > best) {
+					into_base = i;
+					best = sigma_vec(0, i);
+				}
+				break;
+			case PricingRule::bland:
+				if (into_base < 0 || non_base[i] < non_base[into_base])into_base = i;
+				break;
+			case PricingRule::normalized: {
+				value_type score = sigma_vec(0, i) / column_norms[non_base[i]];
+				if (into_base < 0 || score > best) {
+					into_base = i;
+					best = score;
+				}
+				break;
 			}
+			}
+		}
+		return into_base;
+	}
+
+	void compute_column_norms() {
+		column_norms.resize(column_count());
+		auto &col = workspace.p_k;
+		for (auto i = 0; i < column_count(); ++i) {
+			read_column(i, col);
+			column_norms[i] = max(col.norm(), (value_type)mach_eps);
+		}
+	}
+
+	void init_shared(const SimplexMethod &other) {
+		vec_b = other.vec_b;
+		vec_c = other.vec_c;
+		B_inv = other.B_inv;
+		base = other.base;
+		non_base = other.non_base;
+		refinement_steps = other.refinement_steps;
+		column_norms = other.column_norms;
+		verbose = other.verbose;
+		artificial_begin = other.artificial_begin;
+		column_pool = other.column_pool;
+
+		// each solver needs its own streams
+		trans_filename = other.trans_filename;
+		if (other.sharded_trans) {
+			sharded_trans = move(unique_ptr<ShardedMatrixType>{ new ShardedMatrixType{ trans_filename } });
+		}
+		else {
+			ondisk_trans = move(unique_ptr<DiskMatrixType>{ new DiskMatrixType{ trans_filename } });
 		}
 
-		// determine if there is infinite solution
-		bool no_sol = true;
-		auto p_k = ondisk_trans->read_row(non_base[into_base]);
-		p_k.transposeInPlace();
-		for (auto i = 0; i < p_k.rows(); ++i) {
-			if (p_k(i,0) > mach_eps) {
-				no_sol = false;
+		init_workspace();
+		recompute_pi_and_x_b();
+	}
+
+	bool run_once() {
+		// optimal condition check
+		bool optimal = true;
+		const auto &sigma_vec = get_sigma_vec();
+
+		for (auto i = 0; i < sigma_vec.cols(); ++i) {
+			if (sigma_vec(0, i) > mach_eps) {
+				optimal = false;
 				break;
 			}
 		}
 
-		if (no_sol)throw InfiniteSolutionsError{ "infinite solution" };
+		if (optimal)return true;
+
+
+		// find the one that should go into base
+		auto into_base = choose_entering(sigma_vec);
+
+		auto &p_k = workspace.p_k;
+		read_column(non_base[into_base], p_k);
 
 		// find the element that should go out of base
-		DenseMatrixType vec_test{ vec_b.rows(),1 };
-		auto y_k = (B_inv * p_k);
-		auto x_b = get_x_b_vec();
-		for (auto i = 0; i < y_k.rows(); ++i) {
-			if (y_k(i,0) < mach_eps)vec_test(i,0) = numeric_limits<value_type>::max();
-			else vec_test(i,0) = x_b(i,0) / y_k(i,0);
-		}
-
-		auto out_of_base = 0;
-		value_type min_val = vec_test(0,0);
-		for (auto i = 1; i < vec_test.rows(); ++i) {
-			if (vec_test(i,0) < min_val) {
-				min_val = vec_test(i,0);
-				out_of_base = i;
+		// only the nonzeros of y_k can be candidates
+		auto &y_k = workspace.y_k;
+		B_inv.ftran(p_k, y_k);
+
+		auto out_of_base = -1;
+		value_type min_val = numeric_limits<value_type>::max();
+		for (typename SparseVectorType::InnerIterator it(y_k); it; ++it) {
+			if (it.value() < mach_eps)continue;
+			value_type ratio = vec_x_b(it.index(), 0) / it.value();
+			// Bland's rule breaks ties by the smallest variable index
+			bool tie_break = pricing_rule == PricingRule::bland && out_of_base >= 0 &&
+				fpeq(ratio, min_val) && base[it.index()] < base[out_of_base];
+			if (ratio < min_val || tie_break) {
+				min_val = ratio;
+				out_of_base = (int)it.index();
 			}
 		}
 
-		base_alteration(out_of_base,into_base,y_k);
+		// the entering variable can increase without bound
+		if (out_of_base < 0)throw InfiniteSolutionsError{ "infinite solution" };
+
+		base_alteration(out_of_base,into_base,y_k,sigma_vec(0, into_base));
 
 		return false;
 	}
@@ -240,7 +951,7 @@ private:
 		throw runtime_error{ "no solution." };
 	}
 
-	void fill_row(const DenseMatrixType &old_row, DenseMatrixType &new_row, int fill_pos) {
+	void fill_row(const DiskRowType &old_row, DiskRowType &new_row, int fill_pos) {
 		// copy from old row
 		for (auto i = 0; i < old_row.cols(); ++i) {
 			new_row(0, i) = old_row(0, i);
@@ -248,11 +959,11 @@ private:
 
 		// fill the rest with zero
 		for (auto i = old_row.cols(); i < new_row.cols(); ++i) {
-			new_row(0, i) = (value_type)0.0;
+			new_row(0, i) = (storage_type)0.0;
 		}
 
 		// set target position one
-		new_row(0, old_row.cols() + fill_pos) = (value_type)1.0;
+		new_row(0, old_row.cols() + fill_pos) = (storage_type)1.0;
 	}
 
 	// after init, check whether the size of matrices are correct
@@ -277,9 +988,10 @@ private:
 		return (value_type)200 * max;
 	}
 
-	void init_not_extended(const string &filename, const DenseMatrixType &_vec_b, const DenseMatrixType &_vec_c) {
+	void init_not_extended(const string &filename, const DenseMatrixType &_vec_b, const DenseMatrixType &_vec_c,
+		const vector<string> &shard_files = vector<string>{}) {
 		// open the matrix file
-		OnDiskMatrix<value_type> original_mat{ filename };
+		DiskMatrixType original_mat{ filename };
 
 		vector_size_check(original_mat, _vec_b, _vec_c);
 
@@ -290,7 +1002,7 @@ private:
 
 
 		// add artificial variables
-		DenseMatrixType new_row{ 1,ondisk_mat->cols() };
+		DiskRowType new_row{ 1,ondisk_mat->cols() };
 		for (auto i = 0; i < original_mat.rows(); ++i) {
 			auto old_row = move(original_mat.read_row(i));
 			fill_row(old_row, new_row, i);
@@ -302,9 +1014,19 @@ private:
 		
 		// generate transpose matrix
 		cout << "generating transpose matrix...\n";
-		auto trans_filename = filename + string{ "_t" };
-		ondisk_mat->generate_transpose_matrix(trans_filename);
-		ondisk_trans = move(unique_ptr<DiskMatrixType>{new DiskMatrixType{ trans_filename }});
+		if (shard_files.empty()) {
+			trans_filename = filename + string{ "_t" };
+			ondisk_mat->generate_transpose_matrix(trans_filename);
+			ondisk_trans = move(unique_ptr<DiskMatrixType>{new DiskMatrixType{ trans_filename }});
+		}
+		else {
+			// every shard builds its own part of the transpose
+			ondisk_mat->flush();
+			trans_filename = filename + string{ "_t.manifest" };
+			sharded_trans = move(unique_ptr<ShardedMatrixType>{ new ShardedMatrixType{
+				trans_filename,ondisk_mat->cols(),ondisk_mat->rows(),shard_files } });
+			sharded_trans->fill_with_transpose_of(new_filename);
+		}
 
 		// copy b
 		vec_b = _vec_b;
@@ -324,17 +1046,15 @@ private:
 		for (int i = 0; i < _vec_c.cols(); ++i) {
 			non_base.push_back(i);
 		}
+		artificial_begin = (int)_vec_c.cols();
 		for (int i = (int)_vec_c.cols(); i < (int)vec_c.cols(); ++i) {
 			base.push_back(i);
 		}
 
 		// set B_inv matrix
-		vector<TripletType> elements;
-		B_inv = move(SparseMatrixType{ ondisk_mat->rows() ,ondisk_mat->rows() });
-		for (auto i = 0; i < ondisk_mat->rows(); ++i) {
-			elements.emplace_back(TripletType(i, i, (value_type)1));
-		}
-		B_inv.setFromTriplets(elements.begin(), elements.end());
+		B_inv.set_identity((int)ondisk_mat->rows());
+		init_workspace();
+		recompute_pi_and_x_b();
 	}
 };
 
@@ -0,0 +1,348 @@
+#ifndef DEF_SPARSEBASISINVERSE_HPP
+#define DEF_SPARSEBASISINVERSE_HPP
+
+#include "__include.hpp"
+
+
+// explicit inverse of the basis matrix, stored both by rows and by columns
+// so that FTRAN (B_inv * p), BTRAN (c * B_inv) and the basis update only
+// touch the nonzeros involved instead of all m rows
+// every row and column is a slice of one pool of nonzeros; a slice that
+// outgrows its capacity moves to the end of the pool, and the pool is
+// compacted into a spare buffer when the end is reached
+template<typename V>
+class SparseBasisInverse {
+public:
+	using value_type = V;
+	using SparseVectorType = Eigen::SparseVector<value_type>;
+	using SparseMatrixType = Eigen::SparseMatrix<value_type>;
+
+	// a row or a column, valid until the next update()
+	struct VectorView {
+		const int *index;
+		const value_type *value;
+		int size;
+	};
+
+	class InnerIterator {
+	public:
+		InnerIterator(const VectorView &_view) :view{ _view } {}
+
+		explicit operator bool() const { return pos < view.size; }
+		InnerIterator &operator++() { ++pos; return *this; }
+		int index() const { return view.index[pos]; }
+		value_type value() const { return view.value[pos]; }
+
+	private:
+		VectorView view;
+		int pos = 0;
+	};
+
+	SparseBasisInverse() {}
+	explicit SparseBasisInverse(int size) { set_identity(size); }
+
+	void set_identity(int size) {
+		// the pool keeps its capacity
+		dim = size;
+		row_slices.clear();
+		col_slices.clear();
+		pool_used = 0;
+		live_capacity = 0;
+		grow_pool(2 * (int64_t)size * initial_slice_capacity);
+
+		row_slices.resize(size);
+		col_slices.resize(size);
+		for (auto i = 0; i < size; ++i) {
+			place_identity(row_slices[i], i);
+			place_identity(col_slices[i], i);
+		}
+
+		work.assign(size, (value_type)0);
+		marker.assign(size, false);
+		pattern.clear();
+		pattern.reserve(size);
+
+		// scratch vectors of update(), sized for the worst case up front
+		delta.resize(size);
+		rho.resize(size);
+		merged.resize(size);
+	}
+
+	// make room in the pool for nnz_per_vector nonzeros in every row and column
+	void reserve(int nnz_per_vector) {
+		grow_pool(2 * (int64_t)dim * nnz_per_vector);
+	}
+
+	int size() const { return dim; }
+
+	// row r of B_inv, which is also the BTRAN of the unit vector e_r
+	VectorView row(int r) const { return view(row_slices[r]); }
+	VectorView col(int c) const { return view(col_slices[c]); }
+
+	// FTRAN, y = B_inv * p
+	void ftran(const SparseVectorType &p, SparseVectorType &y) {
+		multiply(col_slices, p, y);
+	}
+
+	// BTRAN, pi = c * B_inv (c and pi are row vectors stored as sparse vectors)
+	void btran(const SparseVectorType &c, SparseVectorType &pi) {
+		multiply(row_slices, c, pi);
+	}
+
+	// replace the r-th basic column, y is the FTRAN of the entering column
+	// B_inv' = E * B_inv = B_inv + (eta - e_r) * row_r, only the rows in the
+	// pattern of y and the columns in the pattern of row_r are changed
+	// the pool is grown (geometrically) before anything is changed, so that the
+	// slices moved by this update always fit
+	void update(int r, const SparseVectorType &y) {
+		value_type alpha = y.coeff(r);
+		expr_check(alpha != (value_type)0, "pivot element is zero.");
+
+		// delta = eta - e_r
+		delta.size = 0;
+		for (typename SparseVectorType::InnerIterator it(y); it; ++it) {
+			if (it.index() == r)delta.push_back(r, (value_type)1 / alpha - (value_type)1);
+			else delta.push_back((int)it.index(), -it.value() / alpha);
+		}
+
+		// row r is about to change, keep a copy
+		auto row_r = row(r);
+		rho.size = 0;
+		for (InnerIterator it(row_r); it; ++it) {
+			rho.push_back(it.index(), it.value());
+		}
+
+		// worst case room taken by the moved slices, a pool that holds a dense
+		// inverse is always enough
+		int64_t required = live_capacity;
+		for (auto i = 0; i < rho.size; ++i) {
+			required += slot_capacity(col_slices[rho.index[i]].size + delta.size);
+		}
+		for (auto i = 0; i < delta.size; ++i) {
+			required += slot_capacity(row_slices[delta.index[i]].size + rho.size);
+		}
+		auto dense_capacity = 2 * (int64_t)dim * dim;
+		required = min(required, dense_capacity);
+		if (required > pool_capacity()) {
+			grow_pool(min(max(2 * pool_capacity(), required), dense_capacity));
+		}
+
+		for (auto i = 0; i < rho.size; ++i) {
+			auto &slice = col_slices[rho.index[i]];
+			add_scaled(view(slice), rho.value[i], delta.view(), merged);
+			store(slice, merged);
+		}
+
+		for (auto i = 0; i < delta.size; ++i) {
+			auto &slice = row_slices[delta.index[i]];
+			add_scaled(view(slice), delta.value[i], rho.view(), merged);
+			store(slice, merged);
+		}
+	}
+
+	// number of stored nonzeros
+	int64_t non_zeros() const {
+		int64_t ret = 0;
+		for (auto iter = col_slices.begin(); iter != col_slices.end(); ++iter) {
+			ret += iter->size;
+		}
+		return ret;
+	}
+
+	// number of entries the pool can hold, and how many times it was grown
+	int64_t pool_capacity() const { return (int64_t)pool_index.size(); }
+	int pool_growths() const { return growths; }
+
+	SparseMatrixType to_sparse_matrix() const {
+		using TripletType = Eigen::Triplet<value_type>;
+		vector<TripletType> elements;
+		for (auto j = 0; j < size(); ++j) {
+			for (InnerIterator it(col(j)); it; ++it) {
+				elements.emplace_back(TripletType{ it.index(), j, it.value() });
+			}
+		}
+		SparseMatrixType ret{ size(),size() };
+		ret.setFromTriplets(elements.begin(), elements.end());
+		return ret;
+	}
+
+protected:
+	// a row or a column, capacity entries starting at offset in the pool
+	struct Slice {
+		int64_t offset = 0;
+		int size = 0;
+		int capacity = 0;
+	};
+
+	// a sparse vector with room for all the entries of a row or a column
+	struct Buffer {
+		vector<int> index;
+		vector<value_type> value;
+		int size = 0;
+
+		void resize(int _size) {
+			index.resize(_size);
+			value.resize(_size);
+			size = 0;
+		}
+		void push_back(int i, value_type val) {
+			index[size] = i;
+			value[size] = val;
+			++size;
+		}
+		VectorView view() const { return VectorView{ index.data(),value.data(),size }; }
+	};
+
+	static constexpr int initial_slice_capacity = 4;
+
+	int dim = 0;
+	vector<Slice> row_slices;
+	vector<Slice> col_slices;
+
+	// the pool, and the spare buffer of the same size that it is compacted into
+	vector<int> pool_index;
+	vector<value_type> pool_value;
+	vector<int> spare_index;
+	vector<value_type> spare_value;
+	// end of the last slice, and the sum of the capacities of all slices
+	int64_t pool_used = 0;
+	int64_t live_capacity = 0;
+	int growths = 0;
+
+	// dense accumulator and nonzero marker, both kept clear between calls
+	vector<value_type> work;
+	vector<bool> marker;
+	vector<int> pattern;
+
+	Buffer delta;
+	Buffer rho;
+	Buffer merged;
+
+	VectorView view(const Slice &slice) const {
+		return VectorView{ pool_index.data() + slice.offset,pool_value.data() + slice.offset,slice.size };
+	}
+
+	// capacity given to a slice that has to hold size entries
+	int slot_capacity(int size) const {
+		return min(dim, max(2 * size, initial_slice_capacity));
+	}
+
+	void place_identity(Slice &slice, int i) {
+		slice = Slice{ pool_used,1,initial_slice_capacity };
+		pool_index[slice.offset] = i;
+		pool_value[slice.offset] = (value_type)1;
+		pool_used += slice.capacity;
+		live_capacity += slice.capacity;
+	}
+
+	// the only place where the pool allocates
+	void grow_pool(int64_t capacity) {
+		if (capacity <= pool_capacity())return;
+		++growths;
+		spare_index.resize(capacity);
+		spare_value.resize(capacity);
+		compact();
+		spare_index.resize(capacity);
+		spare_value.resize(capacity);
+	}
+
+	// move every slice to the front of the spare buffer, then swap the buffers
+	void compact() {
+		int64_t used = 0;
+		auto move_slices = [&](vector<Slice> &slices) {
+			for (auto iter = slices.begin(); iter != slices.end(); ++iter) {
+				copy_n(pool_index.begin() + iter->offset, iter->size, spare_index.begin() + used);
+				copy_n(pool_value.begin() + iter->offset, iter->size, spare_value.begin() + used);
+				iter->offset = used;
+				used += iter->capacity;
+			}
+		};
+		move_slices(row_slices);
+		move_slices(col_slices);
+
+		swap(pool_index, spare_index);
+		swap(pool_value, spare_value);
+		pool_used = used;
+	}
+
+	// write the entries into the slice, moving it to the end of the pool if it is too small
+	void store(Slice &slice, const Buffer &entries) {
+		if (entries.size > slice.capacity) {
+			// the old entries are not needed any more, drop them before compacting
+			live_capacity -= slice.capacity;
+			slice.size = 0;
+			slice.capacity = 0;
+
+			auto capacity = slot_capacity(entries.size);
+			if (pool_used + capacity > pool_capacity())compact();
+
+			live_capacity += capacity;
+			slice.offset = pool_used;
+			slice.capacity = capacity;
+			pool_used += capacity;
+		}
+		copy_n(entries.index.begin(), entries.size, pool_index.begin() + slice.offset);
+		copy_n(entries.value.begin(), entries.size, pool_value.begin() + slice.offset);
+		slice.size = entries.size;
+	}
+
+	// ret = a + s * b, exact zeros are dropped
+	void add_scaled(const VectorView &a, value_type s, const VectorView &b, Buffer &ret) {
+		ret.size = 0;
+		auto i_a = 0, i_b = 0;
+		while (i_a < a.size || i_b < b.size) {
+			value_type val;
+			int index;
+			if (i_a < a.size && (i_b == b.size || a.index[i_a] < b.index[i_b])) {
+				index = a.index[i_a];
+				val = a.value[i_a];
+				++i_a;
+			}
+			else if (i_a == a.size || b.index[i_b] < a.index[i_a]) {
+				index = b.index[i_b];
+				val = s * b.value[i_b];
+				++i_b;
+			}
+			else {
+				index = a.index[i_a];
+				val = a.value[i_a] + s * b.value[i_b];
+				++i_a;
+				++i_b;
+			}
+			if (val != (value_type)0)ret.push_back(index, val);
+		}
+	}
+
+	// ret = sum of vecs[j] * x_j over the nonzeros of x
+	// the symbolic pass collects the reachable pattern first (with an explicit
+	// inverse the reach of x is the union of the patterns of vecs[j]), so the
+	// numeric pass and the gather are proportional to the nonzeros touched
+	void multiply(const vector<Slice> &vecs, const SparseVectorType &x, SparseVectorType &ret) {
+		pattern.clear();
+		for (typename SparseVectorType::InnerIterator it(x); it; ++it) {
+			for (InnerIterator jt(view(vecs[it.index()])); jt; ++jt) {
+				if (!marker[jt.index()]) {
+					marker[jt.index()] = true;
+					pattern.push_back(jt.index());
+				}
+			}
+		}
+		sort(pattern.begin(), pattern.end());
+
+		for (typename SparseVectorType::InnerIterator it(x); it; ++it) {
+			for (InnerIterator jt(view(vecs[it.index()])); jt; ++jt) {
+				work[jt.index()] += jt.value() * it.value();
+			}
+		}
+
+		ret.resize(size());
+		for (auto iter = pattern.begin(); iter != pattern.end(); ++iter) {
+			if (work[*iter] != (value_type)0)ret.insertBack(*iter) = work[*iter];
+			work[*iter] = (value_type)0;
+			marker[*iter] = false;
+		}
+	}
+};
+
+
+#endif // !DEF_SPARSEBASISINVERSE_HPP
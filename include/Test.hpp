@@ -10,6 +10,10 @@
 
 #include <cstdlib>
 
+// number of allocations through the global operator new, which is replaced in
+// AllocationCount.cpp (a file of its own, so that new-expressions inlined in the
+// tests are not paired with free)
+extern atomic<size_t> allocation_count;
 
 
 class Timer {
@@ -42,11 +46,38 @@ void test_OnDiskMatrix();
 
 void test_GenerateRandomMatrix();
 
+// test the version 2 file layout: alignment, checksums and opening version 1 files
+void test_OnDiskMatrix_Format();
+
 // test writing an 3000x3000 matrix and reading each row of it
 void test_OnDiskMatrix_ReadingTime();
 
+// replace basis columns one by one and compare B_inv, FTRAN and BTRAN with a dense inverse
+void test_SparseBasisInverse();
+
 void test_SimplexMethod();
 
+// check that the solving loop does not allocate memory after the first iteration
+void test_SimplexMethod_NoAllocation();
+
+// solve a cutting stock LP by column generation and compare with the LP over all patterns
+void test_ColumnGeneration();
+
+// solve a wide problem in sifting mode and compare with the normal mode
+void test_SiftingSimplexMethod();
+
+// solve a problem with the columns split across three files and compare with one file
+void test_ShardedSimplexMethod();
+
+// solve a problem with every pricing rule, alone and concurrently, and compare the optima
+void test_ConcurrentSimplexMethod();
+
+// solve asynchronously with progress reports, iteration and time limits and cancellation
+void test_AsyncSimplexMethod();
+
+// solve the problem of test_SimplexMethod with a float matrix on disk and double computation
+void test_MixedPrecisionSimplexMethod();
+
 // generate a random matrix and test RAM usage, not guaranteed to have a result.
 void test_LargeScaleSimplexMethod();
 
@@ -11,11 +11,24 @@
 #include <utility>
 #include <string>
 #include <fstream>
+#include <filesystem>
 #include <iomanip>
 #include <chrono>
 #include <memory>
 #include <limits>
 #include <map>
+#include <array>
+#include <algorithm>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <atomic>
+#include <future>
 
 using namespace std;
 
@@ -0,0 +1,25 @@
+#include "Test.hpp"
+
+#ifdef COMPILE_TEST
+
+#include <new>
+
+// count every allocation through the global operator new
+atomic<size_t> allocation_count{ 0 };
+
+void* operator new(size_t size) {
+	++allocation_count;
+	void* ptr = malloc(size == 0 ? 1 : size);
+	if (ptr == nullptr)throw bad_alloc{};
+	return ptr;
+}
+
+void operator delete(void* ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void* ptr, size_t) noexcept {
+	free(ptr);
+}
+
+#endif
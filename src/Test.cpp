@@ -2,6 +2,9 @@
 
 #ifdef COMPILE_TEST
 
+#include <atomic>
+#include <filesystem>
+
 
 
 void test_OnDiskMatrix() {
@@ -36,6 +39,117 @@ void test_GenerateRandomMatrix() {
 	}
 }
 
+void test_OnDiskMatrix_Format() {
+	const int rows = 1000;
+	const int cols = 300;
+	Eigen::MatrixXd matrix{ Eigen::MatrixXd::Random(rows,cols) };
+
+	{
+		OnDiskMatrix<double> ondisk{ "format.mat",rows,cols };
+		for (auto i = 0; i < rows; ++i) {
+			ondisk.write_row(matrix.row(i), i);
+		}
+		ondisk.flush();
+
+		auto &header = ondisk.get_header();
+		expr_check(header.version == ondisk_format_version, "wrong format version");
+		expr_check(header.data_offset % ondisk_page_size == 0, "data section is not aligned");
+		expr_check(header.block_count > 1, "expected more than one block");
+	}
+
+	// writes that are not flushed yet leave the file readable by other objects
+	{
+		OnDiskMatrix<double> writer{ "format.mat" };
+		writer.write_row(matrix.row(0) * 2, 0);
+		{
+			OnDiskMatrix<double> reader{ "format.mat" };
+			expr_check(!(reader.get_header().flags & ondisk_flag_checksums), "checksums should be pending");
+			expr_check(reader.get_element(0, 0) == 2 * matrix(0, 0), "the pending write is not visible");
+			expr_check(reader.get_element(rows - 1, 0) == matrix(rows - 1, 0), "elements are different");
+		}
+		writer.write_row(matrix.row(0), 0);
+	}
+
+	// reopen and compare, every block is verified on first read
+	{
+		OnDiskMatrix<double> ondisk{ "format.mat" };
+		expr_check(!ondisk.is_read_only(), "version 2 files should be writable");
+		expr_check(ondisk.get_header().flags & ondisk_flag_checksums, "checksums were not committed");
+		for (auto i = rows - 1; i >= 0; --i) {
+			auto row = ondisk.read_row(i);
+			for (auto j = 0; j < cols; ++j) {
+				expr_check(row(0, j) == matrix(i, j), "elements are different");
+			}
+		}
+
+		// part of a row
+		OnDiskMatrix<double>::MatrixType range{ 1,cols / 2 };
+		ondisk.read_row_range(rows / 2, cols / 4, range);
+		for (auto j = 0; j < range.cols(); ++j) {
+			expr_check(range(0, j) == matrix(rows / 2, cols / 4 + j), "elements are different");
+		}
+	}
+
+	// corrupt one byte of the payload, reading it must fail
+	{
+		OnDiskMatrixHeader header;
+		fstream file{ "format.mat",ios::binary | ios::in | ios::out };
+		file.read(reinterpret_cast<char*>(&header), OnDiskMatrixHeader_size);
+		file.seekp(header.data_offset + 8);
+		file.put('\x7f');
+	}
+	{
+		OnDiskMatrix<double> ondisk{ "format.mat" };
+		auto caught = false;
+		try {
+			ondisk.read_row(0);
+		}
+		catch (runtime_error&) {
+			caught = true;
+		}
+		expr_check(caught, "corrupted block was not detected");
+	}
+
+	// a version 1 file can still be read, but not written
+	{
+		OnDiskMatrixHeaderV1 header{ rows,cols,sizeof(double),{ 'f','6','4' } };
+		fstream file{ "format_v1.mat",ios::binary | ios::out | ios::trunc };
+		file.write(reinterpret_cast<const char*>(&header), OnDiskMatrixHeaderV1_size);
+		for (auto i = 0; i < rows; ++i) {
+			Eigen::Matrix<double, 1, -1> row = matrix.row(i);
+			file.write(reinterpret_cast<const char*>(row.data()), cols * sizeof(double));
+		}
+	}
+	{
+		OnDiskMatrix<double> ondisk{ "format_v1.mat" };
+		expr_check(ondisk.is_read_only(), "version 1 files should be read-only");
+		expr_check(ondisk.get_element(rows - 1, cols - 1) == matrix(rows - 1, cols - 1), "elements are different");
+
+		auto caught = false;
+		try {
+			ondisk.write_row(matrix.row(0), 0);
+		}
+		catch (runtime_error&) {
+			caught = true;
+		}
+		expr_check(caught, "version 1 file was written");
+	}
+
+	// a version 2 file without write permission is opened read-only
+	{
+		using filesystem::perms;
+		filesystem::permissions("format.mat", perms::owner_read, filesystem::perm_options::replace);
+		// a privileged user can still open the file for writing
+		bool writable = fstream{ "format.mat",ios::binary | ios::in | ios::out }.is_open();
+		{
+			OnDiskMatrix<double> ondisk{ "format.mat" };
+			expr_check(ondisk.is_read_only() != writable, "files without write permission should be read-only");
+		}
+		filesystem::permissions("format.mat", perms::owner_read | perms::owner_write, filesystem::perm_options::replace);
+	}
+	cout << "format test passed.\n";
+}
+
 void test_OnDiskMatrix_ReadingTime() {
 	Timer timer;
 	srand(static_cast<unsigned int>(chrono::system_clock::now().time_since_epoch().count()));
@@ -131,6 +245,60 @@ void test_OnDiskMatrix_ReadingTime() {
 
 }
 
+void test_SparseBasisInverse() {
+	using SparseVectorType = SparseBasisInverse<double>::SparseVectorType;
+	const int size = 30;
+	srand(7);
+
+	SparseBasisInverse<double> b_inv{ size };
+	Eigen::MatrixXd basis = Eigen::MatrixXd::Identity(size, size);
+
+	auto to_sparse = [](const Eigen::VectorXd &vec) {
+		SparseVectorType ret{ vec.size() };
+		for (auto i = 0; i < vec.size(); ++i) {
+			if (vec(i) != 0.0)ret.insertBack(i) = vec(i);
+		}
+		return ret;
+	};
+
+	for (auto iter = 0; iter < 60; ++iter) {
+		// a sparse column with up to 3 nonzeros
+		Eigen::VectorXd col = Eigen::VectorXd::Zero(size);
+		for (auto k = 0; k < 3; ++k) {
+			col(rand() % size) = (double)(rand() % 100 + 1) / 10.0;
+		}
+
+		SparseVectorType y;
+		b_inv.ftran(to_sparse(col), y);
+		Eigen::VectorXd dense_y = basis.inverse() * col;
+		expr_check((Eigen::VectorXd{ y } - dense_y).cwiseAbs().maxCoeff() < 1.0e-8, "FTRAN is different");
+
+		// replace a column whose pivot element is large enough
+		int out_pos = -1;
+		for (SparseVectorType::InnerIterator it(y); it; ++it) {
+			if (abs(it.value()) > 0.1) {
+				out_pos = (int)it.index();
+				break;
+			}
+		}
+		if (out_pos < 0)continue;
+
+		b_inv.update(out_pos, y);
+		basis.col(out_pos) = col;
+
+		Eigen::MatrixXd dense_inv = basis.inverse();
+		Eigen::MatrixXd sparse_inv{ b_inv.to_sparse_matrix() };
+		expr_check((sparse_inv - dense_inv).cwiseAbs().maxCoeff() < 1.0e-8, "B_inv is different");
+
+		Eigen::VectorXd c = Eigen::VectorXd::Random(size);
+		SparseVectorType pi;
+		b_inv.btran(to_sparse(c), pi);
+		Eigen::VectorXd dense_pi = dense_inv.transpose() * c;
+		expr_check((Eigen::VectorXd{ pi } - dense_pi).cwiseAbs().maxCoeff() < 1.0e-8, "BTRAN is different");
+	}
+	cout << "basis inverse test passed, " << b_inv.non_zeros() << " nonzeros.\n";
+}
+
 void test_SimplexMethod() {
 	Eigen::MatrixXd mat{ 3,5 };
 	mat << 1., -2., 1., 1., 0.,
@@ -156,6 +324,494 @@ void test_SimplexMethod() {
 	cout << "maximum value: " << max_val << "\n";
 }
 
+void test_MixedPrecisionSimplexMethod() {
+	Eigen::MatrixXf mat{ 3,5 };
+	mat << 1.f, -2.f, 1.f, 1.f, 0.f,
+		-4.f, 1.f, 2.f, 0.f, -1.f,
+		-2.f, 0.f, 1.f, 0.f, 0.f;
+	Eigen::MatrixXd vec_b{ 3,1 };
+	vec_b << 11., 3., 1.;
+	Eigen::MatrixXd vec_c{ 1,5 };
+	vec_c << 3., -1., -1., 0., 0.;
+
+	OnDiskMatrix<float> pmat{ "problem_f32.mat" ,3,5 };
+	for (auto i = 0; i < 3; ++i) {
+		pmat.write_row(mat.row(i), i);
+	}
+
+	SimplexMethod<double, float> simp{ "problem_f32.mat",vec_b,vec_c };
+
+	double max_val;
+	auto sol = simp.solve(max_val);
+	for (auto iter = sol.begin(); iter != sol.end(); ++iter) {
+		cout << "x" << iter->first << " = " << iter->second << "\n";
+	}
+	cout << "maximum value: " << max_val << "\n";
+
+	expr_check(fpeq(max_val, 2.0), "wrong maximum value");
+	expr_check(fpeq(sol[0], 4.0) && fpeq(sol[1], 1.0) && fpeq(sol[2], 9.0), "wrong solution");
+}
+
+// write a random sparse problem with two nonzeros in [0.5, 5] per column and returns its matrix
+// with_slack makes the last rows columns a slack for every row, so that the problem is feasible and bounded
+static Eigen::MatrixXd write_random_sparse_problem(const string &filename, int rows, int cols, unsigned int seed,
+	bool with_slack, Eigen::MatrixXd &vec_b, Eigen::MatrixXd &vec_c) {
+	srand(seed);
+	Eigen::MatrixXd mat = Eigen::MatrixXd::Zero(rows, cols);
+	auto random_cols = with_slack ? cols - rows : cols;
+	for (auto j = 0; j < random_cols; ++j) {
+		mat(rand() % rows, j) = 0.5 + 4.5 * (double)rand() / RAND_MAX;
+		mat(rand() % rows, j) = 0.5 + 4.5 * (double)rand() / RAND_MAX;
+	}
+	if (with_slack) {
+		for (auto i = 0; i < rows; ++i) {
+			mat(i, cols - rows + i) = 1.0;
+		}
+	}
+	vec_b = Eigen::MatrixXd::Random(rows, 1).cwiseAbs() + Eigen::MatrixXd::Ones(rows, 1);
+	vec_c = Eigen::MatrixXd::Random(1, cols);
+
+	OnDiskMatrix<double> pmat{ filename,rows,cols };
+	for (auto i = 0; i < rows; ++i) {
+		pmat.write_row(mat.row(i), i);
+	}
+	return mat;
+}
+
+// exposes a single iteration of the solver
+class SteppingSimplexMethod :public SimplexMethod<double> {
+public:
+	using SimplexMethod<double>::SimplexMethod;
+	using SimplexMethod<double>::run_once;
+	using SimplexMethod<double>::B_inv;
+};
+
+void test_SimplexMethod_NoAllocation() {
+	// B_inv fills in well past the initial room of its pool
+	const int rows = 300;
+	const int cols = 900;
+	Eigen::MatrixXd vec_b, vec_c;
+	write_random_sparse_problem("noalloc.mat", rows, cols, 11, true, vec_b, vec_c);
+
+	// returns the number of allocations of the solving loop, after the first iteration
+	// (which verifies the checksums of the blocks, and may allocate)
+	auto count_allocations = [](SteppingSimplexMethod &simp, int &iterations, int &growths) {
+		auto finished = simp.run_once();
+
+		iterations = 0;
+		auto growths_before = simp.B_inv.pool_growths();
+		size_t count_before = allocation_count;
+		// Eigen also checks its own allocations when the whole test build
+		// defines EIGEN_RUNTIME_NO_MALLOC
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		Eigen::internal::set_is_malloc_allowed(false);
+#endif
+		while (!finished) {
+			finished = simp.run_once();
+			++iterations;
+		}
+#ifdef EIGEN_RUNTIME_NO_MALLOC
+		Eigen::internal::set_is_malloc_allowed(true);
+#endif
+		size_t count_after = allocation_count;
+		growths = simp.B_inv.pool_growths() - growths_before;
+		return count_after - count_before;
+	};
+
+	// only the geometric growth of the pool of B_inv allocates, four buffers each time
+	int iterations, growths;
+	{
+		SteppingSimplexMethod simp{ "noalloc.mat",vec_b,vec_c };
+		simp.set_verbose(false);
+		auto count = count_allocations(simp, iterations, growths);
+		cout << iterations << " iterations, " << count << " allocations, " << growths << " pool growths.\n";
+		expr_check(iterations > rows, "the problem was solved in too few iterations");
+		expr_check(growths > 0, "the pool of B_inv did not grow");
+		expr_check(count == 4 * (size_t)growths, "the solving loop allocated memory outside the pool");
+		expr_check(growths <= 4, "the pool of B_inv did not grow geometrically");
+	}
+
+	// with room for a dense inverse up front, nothing allocates
+	{
+		SteppingSimplexMethod simp{ "noalloc.mat",vec_b,vec_c };
+		simp.set_verbose(false);
+		simp.B_inv.reserve(rows);
+		auto count = count_allocations(simp, iterations, growths);
+		cout << iterations << " iterations, " << count << " allocations with a reserved pool.\n";
+		expr_check(count == 0, "the solving loop allocated memory");
+	}
+}
+
+void test_ColumnGeneration() {
+	using SparseVectorType = SimplexMethod<double>::SparseVectorType;
+
+	// minimize the number of rolls: max -sum(x) s.t. patterns * x - surplus = demand
+	const int roll_width = 20;
+	const vector<int> widths{ 3,5,7,9 };
+	const vector<double> demands{ 25.,20.,18.,15. };
+	const int rows = (int)widths.size();
+
+	Eigen::MatrixXd vec_b{ rows,1 };
+	for (auto i = 0; i < rows; ++i) {
+		vec_b(i, 0) = demands[i];
+	}
+
+	// write a problem with the given patterns and a surplus variable for each row
+	auto write_problem = [&](const string &filename, const vector<vector<int>> &patterns, Eigen::MatrixXd &vec_c) {
+		auto cols = (int)patterns.size() + rows;
+		Eigen::MatrixXd mat = Eigen::MatrixXd::Zero(rows, cols);
+		vec_c = Eigen::MatrixXd::Zero(1, cols);
+		for (auto j = 0; j < (int)patterns.size(); ++j) {
+			for (auto i = 0; i < rows; ++i) {
+				mat(i, j) = patterns[j][i];
+			}
+			vec_c(0, j) = -1.;
+		}
+		for (auto i = 0; i < rows; ++i) {
+			mat(i, patterns.size() + i) = -1.;
+		}
+
+		OnDiskMatrix<double> pmat{ filename,rows,cols };
+		for (auto i = 0; i < rows; ++i) {
+			pmat.write_row(mat.row(i), i);
+		}
+	};
+
+	// enumerate every feasible pattern
+	vector<vector<int>> all_patterns;
+	vector<int> current(rows, 0);
+	function<void(int, int)> enumerate = [&](int item, int remaining) {
+		if (item == rows) {
+			if (remaining < roll_width)all_patterns.push_back(current);
+			return;
+		}
+		for (auto k = 0; k * widths[item] <= remaining; ++k) {
+			current[item] = k;
+			enumerate(item + 1, remaining - k * widths[item]);
+		}
+		current[item] = 0;
+	};
+	enumerate(0, roll_width);
+
+	Eigen::MatrixXd vec_c;
+	write_problem("cutting_full.mat", all_patterns, vec_c);
+	SimplexMethod<double> full{ "cutting_full.mat",vec_b,vec_c };
+	double full_val;
+	full.solve(full_val);
+
+	// start from the patterns that only cut one width
+	vector<vector<int>> initial_patterns;
+	for (auto i = 0; i < rows; ++i) {
+		vector<int> pattern(rows, 0);
+		pattern[i] = roll_width / widths[i];
+		initial_patterns.push_back(pattern);
+	}
+	write_problem("cutting_master.mat", initial_patterns, vec_c);
+	SimplexMethod<double> master{ "cutting_master.mat",vec_b,vec_c };
+
+	// pricing is a knapsack problem over the duals: find a pattern a with -1 - duals * a > 0
+	auto pricing = [&](const Eigen::MatrixXd &duals, SimplexMethod<double>::ColumnBatchType &new_columns) {
+		vector<double> best(roll_width + 1, 0.);
+		vector<int> choice(roll_width + 1, -1);
+		for (auto w = 1; w <= roll_width; ++w) {
+			best[w] = best[w - 1];
+			for (auto i = 0; i < rows; ++i) {
+				if (widths[i] <= w && best[w - widths[i]] - duals(0, i) > best[w]) {
+					best[w] = best[w - widths[i]] - duals(0, i);
+					choice[w] = i;
+				}
+			}
+		}
+		if (best[roll_width] <= 1. + 1.0e-9)return;
+
+		SparseVectorType column{ rows };
+		vector<int> pattern(rows, 0);
+		for (auto w = roll_width; w > 0;) {
+			if (choice[w] < 0) {
+				--w;
+				continue;
+			}
+			++pattern[choice[w]];
+			w -= widths[choice[w]];
+		}
+		for (auto i = 0; i < rows; ++i) {
+			if (pattern[i] != 0)column.insertBack(i) = (double)pattern[i];
+		}
+		new_columns.emplace_back(column, -1.);
+	};
+
+	// a single round adds columns but does not re-optimize over them
+	double master_val;
+	master.solve_column_generation(master_val, pricing, 1);
+	expr_check(!master.is_proven_optimal(), "a truncated solve is reported as optimal");
+
+	// continue from the current basis
+	master.solve_column_generation(master_val, pricing);
+	expr_check(master.is_proven_optimal(), "column generation did not prove the optimum");
+
+	cout << "all patterns: " << full_val << ", column generation: " << master_val
+		<< " with " << master.column_count() << " columns.\n";
+	expr_check(fpeq(full_val, master_val), "column generation did not reach the optimum");
+
+	// a batch with a column of the wrong size is rejected as a whole
+	SimplexMethod<double>::ColumnBatchType bad_batch;
+	bad_batch.emplace_back(SparseVectorType{ rows }, -1.);
+	bad_batch.emplace_back(SparseVectorType{ rows + 1 }, -1.);
+	auto count_before = master.column_count();
+	auto caught = false;
+	try {
+		master.add_columns(bad_batch);
+	}
+	catch (runtime_error&) {
+		caught = true;
+	}
+	expr_check(caught && master.column_count() == count_before, "a bad batch changed the columns");
+	double after_val;
+	master.solve(after_val);
+	expr_check(fpeq(after_val, master_val), "a bad batch changed the problem");
+}
+
+void test_SiftingSimplexMethod() {
+	// a wide sparse problem with a slack for every row
+	const int rows = 30;
+	const int cols = 3000;
+	Eigen::MatrixXd vec_b, vec_c;
+	write_random_sparse_problem("sifting.mat", rows, cols, 5, true, vec_b, vec_c);
+
+	double full_val;
+	SimplexMethod<double> full{ "sifting.mat",vec_b,vec_c };
+	full.solve(full_val);
+
+	// a single round only optimizes over the first working set
+	double sifting_val;
+	SimplexMethod<double> sifting{ "sifting.mat",vec_b,vec_c };
+	sifting.solve_sifting(sifting_val, 100, 1);
+	expr_check(!sifting.is_proven_optimal(), "a truncated solve is reported as optimal");
+
+	// continue from the current basis
+	sifting.solve_sifting(sifting_val, 100);
+	expr_check(sifting.is_proven_optimal(), "sifting did not prove the optimum");
+
+	cout << "normal mode: " << full_val << ", sifting mode: " << sifting_val
+		<< " with " << sifting.get_full_pricing_passes() << " full pricing passes.\n";
+	expr_check(fpeq(full_val, sifting_val), "sifting did not reach the optimum");
+	expr_check(sifting.get_full_pricing_passes() < 20, "too many full pricing passes");
+}
+
+void test_ShardedSimplexMethod() {
+	const int rows = 30;
+	const int cols = 500;
+	Eigen::MatrixXd vec_b, vec_c;
+	auto mat = write_random_sparse_problem("sharded.mat", rows, cols, 3, true, vec_b, vec_c);
+
+	double single_val;
+	SimplexMethod<double> single{ "sharded.mat",vec_b,vec_c };
+	single.solve(single_val);
+
+	double sharded_val;
+	{
+		SimplexMethod<double> sharded{ "sharded.mat",vec_b,vec_c,
+			vector<string>{ "sharded_0.mat","sharded_1.mat","sharded_2.mat" } };
+		sharded.solve(sharded_val);
+	}
+
+	cout << "single file: " << single_val << ", sharded: " << sharded_val << "\n";
+	expr_check(fpeq(single_val, sharded_val), "the sharded problem has a different optimum");
+
+	// the manifest opens the transpose of the extended matrix again
+	ShardedOnDiskMatrix<double> trans{ "sharded.mat_t.manifest" };
+	expr_check(trans.shard_count() == 3, "wrong number of shards");
+	expr_check(trans.rows() == cols + rows && trans.cols() == rows, "wrong size of the sharded matrix");
+	for (auto j = 0; j < cols; ++j) {
+		auto col = trans.read_row(j);
+		for (auto i = 0; i < rows; ++i) {
+			expr_check(col(0, i) == mat(i, j), "elements are different");
+		}
+	}
+
+	// the shard paths are relative to the manifest, so the directory can be moved
+	filesystem::remove_all("shards");
+	filesystem::remove_all("shards_moved");
+	filesystem::create_directory("shards");
+	{
+		ShardedOnDiskMatrix<double> created{ "shards/matrix.manifest",4,3,
+			vector<string>{ "shards/matrix_0.mat","shards/matrix_1.mat" } };
+		for (auto i = 0; i < 4; ++i) {
+			created.write_row(Eigen::MatrixXd::Constant(1, 3, (double)i), i);
+		}
+		created.flush();
+	}
+	filesystem::rename("shards", "shards_moved");
+	{
+		ShardedOnDiskMatrix<double> moved{ "shards_moved/matrix.manifest" };
+		expr_check(moved.shard_count() == 2 && moved.rows() == 4 && moved.cols() == 3, "wrong size of the moved matrix");
+		for (auto i = 0; i < 4; ++i) {
+			expr_check(moved.read_row(i) == Eigen::MatrixXd::Constant(1, 3, (double)i), "elements are different");
+		}
+	}
+	filesystem::remove_all("shards_moved");
+}
+
+void test_ConcurrentSimplexMethod() {
+	const int rows = 30;
+	const int cols = 300;
+	Eigen::MatrixXd vec_b, vec_c;
+	write_random_sparse_problem("concurrent.mat", rows, cols, 4, false, vec_b, vec_c);
+
+	SimplexMethod<double> dantzig{ "concurrent.mat",vec_b,vec_c };
+	dantzig.set_verbose(false);
+	// the copies start from the initial basis of dantzig
+	SimplexMethod<double> bland{ dantzig,PricingRule::bland };
+	SimplexMethod<double> normalized{ dantzig,PricingRule::normalized };
+
+	// every rule reaches the same optimum
+	double dantzig_val, bland_val, normalized_val;
+	dantzig.solve(dantzig_val);
+	bland.solve(bland_val);
+	normalized.solve(normalized_val);
+	cout << "dantzig: " << dantzig_val << ", bland: " << bland_val << ", normalized: " << normalized_val << "\n";
+	expr_check(fpeq(dantzig_val, bland_val) && fpeq(dantzig_val, normalized_val), "the pricing rules have different optima");
+
+	double val;
+	ConcurrentSimplexMethod<double> concurrent{ "concurrent.mat",vec_b,vec_c };
+	auto caught = false;
+	try {
+		concurrent.get_winner_rule();
+	}
+	catch (runtime_error&) {
+		caught = true;
+	}
+	expr_check(caught, "there is a winner before solving");
+
+	auto solution = concurrent.solve(val);
+	cout << "concurrent: " << val << " (winner " << concurrent.get_winner() << ")\n";
+	expr_check(fpeq(dantzig_val, val), "the concurrent solve has a different optimum");
+	expr_check(concurrent.get_winner() >= 0 && concurrent.get_winner() < concurrent.solver_count(), "no winner");
+
+	double check_val = 0;
+	for (auto iter = solution.begin(); iter != solution.end(); ++iter) {
+		check_val += vec_c(0, iter->first) * iter->second;
+	}
+	expr_check(fpeq(check_val, val), "the solution does not match the optimum");
+
+	// a cancelled solver stops after one pivot
+	SimplexMethod<double> cancelled{ "concurrent.mat",vec_b,vec_c };
+	CancellationToken token;
+	cancelled.set_cancellation_token(token);
+	token.cancel();
+	bool thrown = false;
+	try {
+		cancelled.solve(val);
+	}
+	catch (const SolveCancelledError&) {
+		thrown = true;
+	}
+	expr_check(thrown, "the cancelled solver did not stop");
+}
+
+void test_AsyncSimplexMethod() {
+	const int rows = 30;
+	const int cols = 300;
+	Eigen::MatrixXd vec_b, vec_c;
+	write_random_sparse_problem("async.mat", rows, cols, 5, false, vec_b, vec_c);
+
+	using SolverType = SimplexMethod<double>;
+
+	double expected;
+	{
+		SolverType simplex{ "async.mat",vec_b,vec_c };
+		simplex.set_verbose(false);
+		simplex.solve(expected);
+	}
+
+	// report after every pivot
+	SolveLimits limits;
+	limits.progress_interval = 0;
+
+	{
+		SolverType simplex{ "async.mat",vec_b,vec_c };
+		vector<SolverType::SolveProgress> reports;
+		auto handle = simplex.solve_async(limits, [&](const SolverType::SolveProgress &progress) {
+			reports.push_back(progress);
+		});
+		auto result = handle.get();
+
+		cout << "async: " << result.objective << " in " << result.iterations << " iterations, "
+			<< reports.size() << " reports\n";
+		expr_check(result.status == SolveStatus::optimal, "the async solve did not finish");
+		expr_check(fpeq(result.objective, expected), "the async solve has a different optimum");
+		expr_check(fpeq(result.infeasibility, 0.0), "the optimal basis is infeasible");
+		// one report before every pivot and before the optimality check, plus the final one
+		expr_check((int64_t)reports.size() == result.iterations + 2, "wrong number of progress reports");
+		for (size_t i = 0; i + 1 < reports.size(); ++i) {
+			expr_check(reports[i].iterations == (int64_t)i, "progress reports are out of order");
+		}
+		expr_check(reports.back().iterations == result.iterations, "wrong iterations in the last report");
+		expr_check(fpeq(reports.back().infeasibility, 0.0), "the last report is infeasible");
+	}
+
+	// the iteration limit returns the current basis
+	{
+		SolverType simplex{ "async.mat",vec_b,vec_c };
+		SolveLimits iteration_limits;
+		iteration_limits.iteration_limit = 5;
+		auto result = simplex.solve_async(iteration_limits).get();
+		expr_check(result.status == SolveStatus::iteration_limit && result.iterations == 5, "the iteration limit is not respected");
+		for (auto iter = result.solution.begin(); iter != result.solution.end(); ++iter) {
+			expr_check(iter->first < cols, "the current solution holds an artificial variable");
+		}
+	}
+
+	// nothing is done past the time limit
+	{
+		SolverType simplex{ "async.mat",vec_b,vec_c };
+		SolveLimits time_limits;
+		time_limits.time_limit = 0;
+		auto result = simplex.solve_async(time_limits).get();
+		expr_check(result.status == SolveStatus::time_limit && result.iterations == 0, "the time limit is not respected");
+	}
+
+	// cancelled from the progress callback after 3 pivots
+	{
+		SolverType simplex{ "async.mat",vec_b,vec_c };
+		CancellationToken token;
+		simplex.set_cancellation_token(token);
+		auto handle = simplex.solve_async(limits, [&](const SolverType::SolveProgress &progress) {
+			if (progress.iterations == 3)token.cancel();
+		});
+		handle.wait();
+		expr_check(handle.is_ready(), "the handle is not ready");
+		auto result = handle.get();
+		expr_check(result.status == SolveStatus::cancelled && result.iterations == 3, "the cancellation is not respected");
+	}
+
+	// cancelling a handle only stops its own solve
+	{
+		SolverType simplex{ "async.mat",vec_b,vec_c };
+		atomic<bool> reached{ false };
+		atomic<bool> handle_cancelled{ false };
+		auto handle = simplex.solve_async(limits, [&](const SolverType::SolveProgress &progress) {
+			// hold the solve after 3 pivots until the handle is cancelled
+			if (progress.iterations != 3)return;
+			reached = true;
+			while (!handle_cancelled) {
+				this_thread::yield();
+			}
+		});
+		while (!reached) {
+			this_thread::yield();
+		}
+		handle.cancel();
+		handle_cancelled = true;
+		auto result = handle.get();
+		expr_check(result.status == SolveStatus::cancelled && result.iterations == 3, "the handle did not cancel the solve");
+
+		// the next solve resumes from the current basis
+		result = simplex.solve_async().get();
+		expr_check(result.status == SolveStatus::optimal && fpeq(result.objective, expected), "a cancelled handle stopped the next solve");
+	}
+}
+
 void test_LargeScaleSimplexMethod() {
 	// generate a 2000x3000 random matrix
 	